@@ -0,0 +1,8 @@
+#!/bin/sh
+COUNT=${1:-10}
+for I in testdata/*.mscript benchmark/*.mscript
+do 
+    echo BENCH $I
+     bin/mscript_cli bench $I $COUNT
+     echo "------------------"
+done
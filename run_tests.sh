@@ -6,3 +6,31 @@ do
      echo "------------------"
 done 
 
+echo TEST memtest
+bin/mscript_cli memtest
+echo "------------------"
+
+echo TEST cachetest
+CACHEDIR=`mktemp -d`
+bin/mscript_cli cachetest testdata/005_range_for.mscript $CACHEDIR
+rm -rf $CACHEDIR
+echo "------------------"
+
+#compiled scripts must be loaded back and give the same result
+for I in testdata/*.mscript
+do
+    echo TEST roundtrip $I
+    if bin/mscript_cli compile $I /tmp/mscript_roundtrip.mscb 2>/dev/null
+    then
+        bin/mscript_cli run $I > /tmp/mscript_roundtrip.expected 2>&1
+        bin/mscript_cli run /tmp/mscript_roundtrip.mscb > /tmp/mscript_roundtrip.result 2>&1
+        if cmp -s /tmp/mscript_roundtrip.expected /tmp/mscript_roundtrip.result
+        then echo OK
+        else echo FAILED
+        fi
+    else
+        echo "not serializable, skipped"
+    fi
+    echo "------------------"
+done
+rm -f /tmp/mscript_roundtrip.mscb /tmp/mscript_roundtrip.expected /tmp/mscript_roundtrip.result
@@ -0,0 +1,57 @@
+/*
+ * atoms.cpp
+ *
+ *  Created on: 18. 10. 2026
+ *      Author: ondra
+ */
+
+#include <mutex>
+#include <unordered_map>
+#include "atoms.h"
+#include "vm_memory.h"
+
+namespace mscript {
+
+namespace {
+
+struct Table {
+	std::mutex mx;
+	///keys reference strings of the values
+	std::unordered_map<std::string_view, Value> names;
+};
+
+Table &getTable() {
+	static Table t;
+	return t;
+}
+
+}
+
+Value Atoms::intern(std::string_view name) {
+	Table &t = getTable();
+	std::lock_guard _(t.mx);
+	auto iter = t.names.find(name);
+	if (iter != t.names.end()) return iter->second;
+	//atoms live forever, so they are not accounted to a virtual machine
+	MemoryMeter::Scope _m(nullptr);
+	Value v(name);
+	std::string_view key = v.getString();
+	t.names.emplace(key, v);
+	return v;
+}
+
+bool Atoms::isAtom(const Value &v) {
+	if (v.type() != json::string) return false;
+	Table &t = getTable();
+	std::lock_guard _(t.mx);
+	auto iter = t.names.find(v.getString());
+	return iter != t.names.end() && iter->second.getHandle() == v.getHandle();
+}
+
+std::size_t Atoms::count() {
+	Table &t = getTable();
+	std::lock_guard _(t.mx);
+	return t.names.size();
+}
+
+}
@@ -0,0 +1,42 @@
+/*
+ * atoms.h
+ *
+ *  Created on: 18. 10. 2026
+ *      Author: ondra
+ */
+
+#ifndef SRC_MSCRIPT_ATOMS_H_
+#define SRC_MSCRIPT_ATOMS_H_
+
+#include <functional>
+#include <string_view>
+#include "value.h"
+
+namespace mscript {
+
+///Global table of interned identifiers
+/**
+ * Compiler and loader of compiled blocks intern names of variables, so all occurrences
+ * of the same name share one string value. Such names can be compared by pointer
+ * (see Scope::Key). The table is shared by all threads and it is never shrunk,
+ * so it should contain identifiers only, not arbitrary strings.
+ */
+class Atoms {
+public:
+	///Intern the name
+	/**
+	 * @param name name to intern
+	 * @return string value shared by all callers interning the same name
+	 */
+	static Value intern(std::string_view name);
+	///Calculates hash of the name. Used to precompute hashes of variables (see Block::hashNames)
+	static std::size_t hash(std::string_view name) {return std::hash<std::string_view>()(name);}
+	///Determines whether the value is interned name (not just equal string)
+	static bool isAtom(const Value &v);
+	///Retrieves count of interned names
+	static std::size_t count();
+};
+
+}
+
+#endif /* SRC_MSCRIPT_ATOMS_H_ */
@@ -5,6 +5,7 @@
  *      Author: ondra
  */
 
+#include <atomic>
 #include <cmath>
 #include <imtjson/serializer.h>
 #include <imtjson/string.h>
@@ -92,6 +93,13 @@ json::NamedEnum<Cmd> strCmd({
 	{Cmd::is_def,"ISDEF"},
 	{Cmd::is_def_1,"ISDEF @1"},
 	{Cmd::is_def_2,"ISDEF @2"},
+	{Cmd::load_local_1,"LOADL #1"},
+	{Cmd::load_local_2,"LOADL #2"},
+	{Cmd::store_local_1,"STOREL #1"},
+	{Cmd::store_local_2,"STOREL #2"},
+	{Cmd::pop_local_1,"POPL #1"},
+	{Cmd::pop_local_2,"POPL #2"},
+	{Cmd::load_outer,"LOADO $2"},
 	{Cmd::op_add_const_1,"ADD $1"},
 	{Cmd::op_add_const_2,"ADD $2"},
 	{Cmd::op_add_const_4,"ADD $4"},
@@ -108,131 +116,437 @@ json::NamedEnum<Cmd> strCmd({
 	{Cmd::op_cmp_eq_2,"EQ @2"},
 	{Cmd::op_mkrange,"MKRANGE"},
 	{Cmd::op_checkbound,"CHKBOUND"},
+	{Cmd::iter_begin,"ITRBEGIN"},
+	{Cmd::iter_next_1,"ITRNEXT ^1"},
+	{Cmd::iter_next_2,"ITRNEXT ^2"},
+	{Cmd::iter_end,"ITREND"},
+	{Cmd::loop_enter_1,"LOOPENTER #1"},
+	{Cmd::loop_enter_2,"LOOPENTER #2"},
+	{Cmd::loop_leave,"LOOPLEAVE"},
+	{Cmd::arg_window,"ARGWND $1"},
+	{Cmd::tail_call,"TCALL"},
+	{Cmd::tail_call_1,"TCALL @1"},
+	{Cmd::tail_call_2,"TCALL @2"},
+	{Cmd::tail_mcall_1,"TMCALL @1"},
+	{Cmd::tail_mcall_2,"TMCALL @2"},
+	{Cmd::switch_table_1,"SWITCH @1"},
+	{Cmd::switch_table_2,"SWITCH @2"},
 
 
 });
 
-BlockExecution::BlockExecution(Value block):block_value(block),block(getBlockFromValue(block)) {
+void Block::hashNames() {
+	constHashes.clear();
+	constHashes.reserve(consts.size());
+	for (const Value &v: consts) {
+		constHashes.push_back(v.type() == json::string?Atoms::hash(v.getString()):0);
+	}
+	localHashes.clear();
+	localHashes.reserve(locals.size());
+	for (const Value &v: locals) {
+		localHashes.push_back(Atoms::hash(v.getString()));
+	}
+	localIndex.clear();
+	if (locals.empty()) return;
+	std::size_t sz = 4;
+	while (sz < locals.size() * 2) sz *= 2;
+	localIndex.resize(sz, 0);
+	for (std::size_t i = 0; i < locals.size(); i++) {
+		std::size_t pos = localHashes[i] & (sz - 1);
+		while (localIndex[pos]) pos = (pos + 1) & (sz - 1);
+		localIndex[pos] = static_cast<std::uint32_t>(i + 1);
+	}
+}
+
+std::size_t Block::findLocal(const Scope::Key &name) const {
+	if (localIndex.empty()) return npos;
+	std::size_t mask = localIndex.size() - 1;
+	std::size_t pos = name.hash & mask;
+	while (localIndex[pos]) {
+		std::size_t slot = localIndex[pos] - 1;
+		const Value &v = locals[slot];
+		if (v.getHandle().get() == name.handle
+				|| (localHashes[slot] == name.hash && v.getString() == name.name)) return slot;
+		pos = (pos + 1) & mask;
+	}
+	return npos;
+}
+
+bool SwitchTable::isIntLabel(const Value &v) {
+	return v.type() == json::number && (v.flags() & (json::numberInteger|json::numberUnsignedInteger));
+}
+
+bool SwitchTable::isSuitable(const std::vector<Value> &labels) {
+	if (labels.size() < minLabels) return false;
+	if (std::all_of(labels.begin(), labels.end(), [](const Value &v){return v.type() == json::string;})) return true;
+	if (!std::all_of(labels.begin(), labels.end(), isIntLabel)) return false;
+	auto mm = std::minmax_element(labels.begin(), labels.end(), [](const Value &a, const Value &b){
+		return a.getIntLong() < b.getIntLong();
+	});
+	//the range is small and it is not too sparse
+	std::uint64_t span = static_cast<std::uint64_t>(mm.second->getIntLong()) - static_cast<std::uint64_t>(mm.first->getIntLong());
+	return span < maxDenseSize && span < 4 * labels.size();
+}
+
+SwitchTable::SwitchTable(std::vector<Value> labels, std::vector<std::size_t> targets)
+	:labels(std::move(labels)),targets(std::move(targets)) {
+	if (!isSuitable(this->labels) || this->labels.size() != this->targets.size()) {
+		throw BuildError("Labels are not suitable for the switch table");
+	}
+	auto cnt = this->labels.size();
+	if (this->labels[0].type() == json::string) {
+		hashed.reserve(cnt);
+		//first label wins, same as a sequence of comparisons
+		for (std::size_t i = 0; i < cnt; i++) hashed.emplace(this->labels[i].getString(), i);
+	} else {
+		auto mm = std::minmax_element(this->labels.begin(), this->labels.end(), [](const Value &a, const Value &b){
+			return a.getIntLong() < b.getIntLong();
+		});
+		base = mm.first->getIntLong();
+		dense.resize(static_cast<std::size_t>(mm.second->getIntLong() - base) + 1, npos);
+		for (std::size_t i = 0; i < cnt; i++) {
+			auto &d = dense[static_cast<std::size_t>(this->labels[i].getIntLong() - base)];
+			if (d == npos) d = i;
+		}
+	}
+}
+
+std::size_t SwitchTable::find(const Value &v) const {
+	if (!dense.empty()) {
+		if (v.type() != json::number) return npos;
+		if (!(v.flags() & (json::numberInteger|json::numberUnsignedInteger))) {
+			//non-integer number can be equal to the label, when it has no fractional part
+			double d = v.getNumber();
+			if (!(d >= static_cast<double>(base) && d < static_cast<double>(base) + static_cast<double>(dense.size()))) return npos;
+		}
+		std::uint64_t idx = static_cast<std::uint64_t>(v.getIntLong()) - static_cast<std::uint64_t>(base);
+		if (idx >= dense.size()) return npos;
+		auto l = dense[idx];
+		//verify the label, so the result is same as result of the comparison
+		if (l == npos || labels[l] != v) return npos;
+		return targets[l];
+	} else {
+		if (v.type() != json::string) return npos;
+		auto iter = hashed.find(v.getString());
+		if (iter == hashed.end()) return npos;
+		return targets[iter->second];
+	}
+}
+
+BlockExecution::BlockExecution(Value block):block_value(block),block(&getBlockFromValue(block)),consts(this->block->consts.data()) {
 
 }
 
 BlockExecution::BlockExecution(const BlockExecution &other)
-:block_value(other.block_value),block(getBlockFromValue(other.block_value)) {
+:block_value(other.block_value),block(&getBlockFromValue(other.block_value)),consts(block->consts.data()),handlers(other.handlers) {
 
 }
 
 bool BlockExecution::init(VirtualMachine &vm) {
+	if (vm.getConfig().pinConstants && !block->consts.empty()) {
+		pinnedConsts = vm.pin_consts(block_value, block->consts);
+		consts = pinnedConsts->data();
+	}
+#ifdef MSCRIPT_THREADED_DISPATCH
+	if (vm.getConfig().threadedDispatch) {
+		handlers = std::atomic_load(&block->handlers);
+		if (!handlers) dispatch_threaded(vm, nullptr);
+	}
+#endif
 	return true;
 }
 
-bool BlockExecution::run(VirtualMachine &vm) {
-	if (ip >= block.code.size()) {
-		return false;
+static constexpr json::ValueTypeFlags intNumberFlags = json::numberInteger| json::numberUnsignedInteger;
+
+static bool isIntNumber(const Value &v) {
+	return (v.flags() & intNumberFlags) != 0;
+}
+
+//numeric operations for the fast path. They must return same result as generic operations
+//for numbers (op_add, op_sub, etc)
+
+struct NumAdd {
+	static constexpr bool checkZero = false;
+	std::int64_t operator()(std::int64_t a, std::int64_t b) const {return a+b;}
+	double operator()(double a, double b) const {return a+b;}
+};
+struct NumSub {
+	static constexpr bool checkZero = false;
+	std::int64_t operator()(std::int64_t a, std::int64_t b) const {return a-b;}
+	double operator()(double a, double b) const {return a-b;}
+};
+struct NumMult {
+	static constexpr bool checkZero = false;
+	std::int64_t operator()(std::int64_t a, std::int64_t b) const {return a*b;}
+	double operator()(double a, double b) const {return a*b;}
+};
+struct NumMod {
+	//integer modulo by zero is left to the generic operation
+	static constexpr bool checkZero = true;
+	std::int64_t operator()(std::int64_t a, std::int64_t b) const {return a%b;}
+	double operator()(double a, double b) const {return std::fmod(a,b);}
+};
+
+template<typename Op>
+void BlockExecution::num_op(VirtualMachine &vm, Value (*fn)(const Value &a, const Value &b)) {
+	if (vm.stack_size() >= 2) {
+		Value &b = vm.top_ref(0);
+		Value &a = vm.top_ref(1);
+		if (a.type() == json::number && b.type() == json::number) {
+			Op op;
+			if (isIntNumber(a) && isIntNumber(b)) {
+				std::int64_t bv = b.getIntLong();
+				if (!Op::checkZero || bv != 0) {
+					a = intValue(op(static_cast<std::int64_t>(a.getIntLong()), bv));
+					vm.del_value();
+					return;
+				}
+			} else {
+				a = Value(op(a.getNumber(), b.getNumber()));
+				vm.del_value();
+				return;
+			}
+		}
+	}
+	bin_op(vm, fn);
+}
+
+template<typename Op>
+void BlockExecution::num_op_const(VirtualMachine &vm, std::int64_t val, Value (*fn)(const Value &a, const Value &b)) {
+	if (vm.stack_size() >= 1) {
+		Value &a = vm.top_ref(0);
+		if (a.type() == json::number) {
+			Op op;
+			if (isIntNumber(a)) {
+				a = intValue(op(static_cast<std::int64_t>(a.getIntLong()), val));
+			} else {
+				a = Value(op(a.getNumber(), static_cast<double>(val)));
+			}
+			return;
+		}
+	}
+	bin_op_const(vm, val, fn);
+}
+
+void BlockExecution::negadd_const(VirtualMachine &vm, std::int64_t val) {
+	if (vm.stack_size() >= 1) {
+		Value &a = vm.top_ref(0);
+		if (a.type() == json::number) {
+			//unary minus always produces a double, so does the fast path
+			a = Value(static_cast<double>(val) - a.getNumber());
+			return;
+		}
 	}
+	unar_op(vm,op_unar_minus);
+	bin_op_const(vm, val, op_add);
+}
+
+bool BlockExecution::run(VirtualMachine &vm) {
+#ifdef MSCRIPT_THREADED_DISPATCH
+	if (handlers) return dispatch_threaded(vm, handlers->data());
+#endif
+	return dispatch_switch(vm);
+}
+
+bool BlockExecution::dispatch_switch(VirtualMachine &vm) {
+#define VM_OP(x) case Cmd::x
+#define VM_NEXT() break
+	const unsigned int batch = std::max(vm.get_batch_size(), 1U);
+	unsigned int budget = batch;
 	try {
-		Cmd cmd = static_cast<Cmd>(block.code[ip]);
-		++ip;
-		switch (cmd) {
-			case Cmd::noop:	break;
-			case Cmd::push_int_1: vm.push_value(load_int1());break;
-			case Cmd::push_int_2: vm.push_value(load_int2());break;
-			case Cmd::push_int_4: vm.push_value(load_int4());break;
-			case Cmd::push_int_8: vm.push_value(load_int8());break;
-			case Cmd::push_double: vm.push_value(load_double());break;
-			case Cmd::push_const_1: vm.push_value(block.consts[load_int1()]);break;
-			case Cmd::push_const_2: vm.push_value(block.consts[load_int2()]);break;
-			case Cmd::begin_list: vm.begin_list();break;
-			case Cmd::close_list: vm.finish_list();break;
-			case Cmd::expand_array: vm.push_values(vm.pop_value());break;
-			case Cmd::collapse_list_1: vm.collapse_param_pack();vm.push_value(vm.pop_value().slice(load_int1()));break;
-			case Cmd::dup: vm.dup_value();break;
-			case Cmd::dup_1: vm.dup_value(load_int1());break;
-			case Cmd::vlist_pop: vlist_pop(vm);break;
-			case Cmd::combine: combine_results(vm);break;
-			case Cmd::del: vm.del_value();break;
-			case Cmd::swap: vm.swap_value();break;
-			case Cmd::swap_1: vm.swap_value(load_int1());break;
-			case Cmd::get_var_1: getVar(vm,load_int1());break;
-			case Cmd::get_var_2: getVar(vm,load_int2());break;
-			case Cmd::deref: deref(vm,vm.pop_value());break;
-			case Cmd::deref_1: deref(vm,block.consts[load_int1()]);break;
-			case Cmd::deref_2: deref(vm,block.consts[load_int2()]);break;
-			case Cmd::call: vm.call_function_raw(vm.pop_value(),Value());break;
-			case Cmd::call_1: vm.call_function_raw(pickVar(vm, load_int1()),Value());break;
-			case Cmd::call_2: vm.call_function_raw(pickVar(vm, load_int2()),Value());break;
-			case Cmd::mcall: {Value fnval=vm.pop_value();vm.call_function_raw(fnval,vm.pop_value());};break;
-			case Cmd::mcall_1: mcall_fn(vm,block.consts[load_int1()]);break;
-			case Cmd::mcall_2: mcall_fn(vm,block.consts[load_int2()]);break;
-			case Cmd::exec_block: exec_block(vm);break;
-			case Cmd::push_scope: vm.push_scope(Value());break;
-			case Cmd::pop_scope: vm.pop_scope();break;
-			case Cmd::push_scope_object: vm.push_scope(vm.pop_value());break;
-			case Cmd::scope_to_object: vm.push_value(vm.scope_to_object());break;
-			case Cmd::raise:do_raise(vm);break;
-			case Cmd::set_var_1: set_var(vm,load_int1());break;
-			case Cmd::set_var_2: set_var(vm,load_int2());break;
-			case Cmd::pop_var_1: set_var(vm,load_int1());vm.del_value();break;
-			case Cmd::pop_var_2: set_var(vm,load_int2());vm.del_value();break;
-			case Cmd::op_add: bin_op(vm,op_add);break;
-			case Cmd::op_sub: bin_op(vm,op_sub);break;
-			case Cmd::op_mult: bin_op(vm,op_mult);break;
-			case Cmd::op_div: bin_op(vm,op_div);break;
-			case Cmd::op_mod: bin_op(vm,op_mod);break;
-			case Cmd::op_cmp_eq: op_cmp(vm,[](int x){return x == 0;});break;
-			case Cmd::op_cmp_less: op_cmp(vm,[](int x){return x < 0;});break;
-			case Cmd::op_cmp_greater: op_cmp(vm,[](int x){return x > 0;});break;
-			case Cmd::op_cmp_less_eq: op_cmp(vm,[](int x){return x <= 0;});break;
-			case Cmd::op_cmp_greater_eq: op_cmp(vm,[](int x){return x >= 0;});break;
-			case Cmd::op_cmp_not_eq: op_cmp(vm,[](int x){return x != 0;});break;
-			case Cmd::op_cmp_eq_1: op_cmp_const(vm,load_int1());break;
-			case Cmd::op_cmp_eq_2: op_cmp_const(vm,load_int2());break;
-			case Cmd::op_bool_and: bin_op(vm,op_and);break;
-			case Cmd::op_bool_or: bin_op(vm,op_or);break;
-			case Cmd::op_bool_not: unar_op(vm,op_not);break;
-			case Cmd::op_power: bin_op(vm,op_power);break;
-			case Cmd::jump_1: ip+=load_int1();break;
-			case Cmd::jump_2: ip+=load_int2();break;
-			case Cmd::jump_true_1: ip+=load_int1() * (vm.pop_value().getBool()?1:0);break;
-			case Cmd::jump_true_2: ip+=load_int2() * (vm.pop_value().getBool()?1:0);break;
-			case Cmd::jump_false_1: ip+=load_int1() * (vm.pop_value().getBool()?0:1);break;
-			case Cmd::jump_false_2: ip+=load_int2() * (vm.pop_value().getBool()?0:1);break;
-			case Cmd::exit_block: ip = block.code.size();break;
-			case Cmd::push_false: vm.push_value(false);break;
-			case Cmd::push_true: vm.push_value(true);break;
-			case Cmd::push_null: vm.push_value(nullptr);break;
-			case Cmd::push_zero_int: vm.push_value(0);break;
-			case Cmd::push_undefined: vm.push_value(json::undefined);break;
-			case Cmd::op_unary_minus: unar_op(vm, op_unar_minus);break;
-			case Cmd::op_mkrange: bin_op(vm, op_mkrange);break;
-			case Cmd::push_array_1: do_push_array(vm, load_int1());break;
-			case Cmd::push_array_2: do_push_array(vm, load_int2());break;
-			case Cmd::push_array_4: do_push_array(vm, load_int4());break;
-			case Cmd::is_def: vm.push_value(vm.pop_value().defined());break;
-			case Cmd::is_def_1: do_isdef(vm, load_int1());break;
-			case Cmd::is_def_2: do_isdef(vm, load_int2());break;
-			case Cmd::op_add_const_1: bin_op_const(vm, load_int1(), op_add);break;
-			case Cmd::op_add_const_2: bin_op_const(vm, load_int2(), op_add);break;
-			case Cmd::op_add_const_4: bin_op_const(vm, load_int4(), op_add);break;
-			case Cmd::op_add_const_8: bin_op_const(vm, load_int8(), op_add);break;
-			case Cmd::op_negadd_const_1: unar_op(vm,op_unar_minus);bin_op_const(vm, load_int1(), op_add);break;
-			case Cmd::op_negadd_const_2: unar_op(vm,op_unar_minus);bin_op_const(vm, load_int2(), op_add);break;
-			case Cmd::op_negadd_const_4: unar_op(vm,op_unar_minus);bin_op_const(vm, load_int4(), op_add);break;
-			case Cmd::op_negadd_const_8: unar_op(vm,op_unar_minus);bin_op_const(vm, load_int8(), op_add);break;
-			case Cmd::op_mult_const_1: bin_op_const(vm, load_int1(), op_mult);break;
-			case Cmd::op_mult_const_2: bin_op_const(vm, load_int2(), op_mult);break;
-			case Cmd::op_mult_const_4: bin_op_const(vm, load_int4(), op_mult);break;
-			case Cmd::op_mult_const_8: bin_op_const(vm, load_int8(), op_mult);break;
-			case Cmd::op_checkbound: bin_op(vm, op_checkbound);break;
-
-			default: invalid_instruction(vm,cmd);
+		do {
+			if (ip >= block->code.size()) {
+				vm.charge_steps(batch - budget);
+				return false;
+			}
+			Cmd cmd = static_cast<Cmd>(block->code[ip]);
+			++ip;
+			switch (cmd) {
+#include "block_dispatch.h"
+				default: invalid_instruction(vm,cmd);
+			}
+			//continue while there is budget and no task has been pushed or exception raised
+		} while (--budget && vm.can_continue());
+		vm.charge_steps(batch - budget);
+		return true;
+	} catch (...) {
+		vm.charge_steps(batch - budget);
+		vm.raise(std::current_exception());
+		return true;
+	}
+#undef VM_OP
+#undef VM_NEXT
+}
+
+#ifdef MSCRIPT_THREADED_DISPATCH
+
+bool BlockExecution::dispatch_threaded(VirtualMachine &vm, const void * const *stream) {
+#define VM_OP(x) lbl_##x
+#define VM_NEXT() goto dispatch_next
+#define VM_HANDLER(x) {Cmd::x, &&lbl_##x}
+
+	if (stream == nullptr) {
+		static const std::pair<Cmd, const void *> handlerTable[] = {
+			VM_HANDLER(noop),
+			VM_HANDLER(push_int_1),
+			VM_HANDLER(push_int_2),
+			VM_HANDLER(push_int_4),
+			VM_HANDLER(push_int_8),
+			VM_HANDLER(push_double),
+			VM_HANDLER(push_const_1),
+			VM_HANDLER(push_const_2),
+			VM_HANDLER(begin_list),
+			VM_HANDLER(close_list),
+			VM_HANDLER(expand_array),
+			VM_HANDLER(collapse_list_1),
+			VM_HANDLER(dup),
+			VM_HANDLER(dup_1),
+			VM_HANDLER(vlist_pop),
+			VM_HANDLER(combine),
+			VM_HANDLER(del),
+			VM_HANDLER(swap),
+			VM_HANDLER(swap_1),
+			VM_HANDLER(get_var_1),
+			VM_HANDLER(get_var_2),
+			VM_HANDLER(deref),
+			VM_HANDLER(deref_1),
+			VM_HANDLER(deref_2),
+			VM_HANDLER(call),
+			VM_HANDLER(call_1),
+			VM_HANDLER(call_2),
+			VM_HANDLER(mcall),
+			VM_HANDLER(mcall_1),
+			VM_HANDLER(mcall_2),
+			VM_HANDLER(exec_block),
+			VM_HANDLER(push_scope),
+			VM_HANDLER(pop_scope),
+			VM_HANDLER(push_scope_object),
+			VM_HANDLER(scope_to_object),
+			VM_HANDLER(raise),
+			VM_HANDLER(set_var_1),
+			VM_HANDLER(set_var_2),
+			VM_HANDLER(pop_var_1),
+			VM_HANDLER(pop_var_2),
+			VM_HANDLER(op_add),
+			VM_HANDLER(op_sub),
+			VM_HANDLER(op_mult),
+			VM_HANDLER(op_div),
+			VM_HANDLER(op_mod),
+			VM_HANDLER(op_cmp_eq),
+			VM_HANDLER(op_cmp_less),
+			VM_HANDLER(op_cmp_greater),
+			VM_HANDLER(op_cmp_less_eq),
+			VM_HANDLER(op_cmp_greater_eq),
+			VM_HANDLER(op_cmp_not_eq),
+			VM_HANDLER(op_cmp_eq_1),
+			VM_HANDLER(op_cmp_eq_2),
+			VM_HANDLER(op_bool_and),
+			VM_HANDLER(op_bool_or),
+			VM_HANDLER(op_bool_not),
+			VM_HANDLER(op_power),
+			VM_HANDLER(jump_1),
+			VM_HANDLER(jump_2),
+			VM_HANDLER(jump_true_1),
+			VM_HANDLER(jump_true_2),
+			VM_HANDLER(jump_false_1),
+			VM_HANDLER(jump_false_2),
+			VM_HANDLER(exit_block),
+			VM_HANDLER(push_false),
+			VM_HANDLER(push_true),
+			VM_HANDLER(push_null),
+			VM_HANDLER(push_zero_int),
+			VM_HANDLER(push_undefined),
+			VM_HANDLER(op_unary_minus),
+			VM_HANDLER(op_mkrange),
+			VM_HANDLER(push_array_1),
+			VM_HANDLER(push_array_2),
+			VM_HANDLER(push_array_4),
+			VM_HANDLER(is_def),
+			VM_HANDLER(is_def_1),
+			VM_HANDLER(is_def_2),
+			VM_HANDLER(load_local_1),
+			VM_HANDLER(load_local_2),
+			VM_HANDLER(store_local_1),
+			VM_HANDLER(store_local_2),
+			VM_HANDLER(pop_local_1),
+			VM_HANDLER(pop_local_2),
+			VM_HANDLER(load_outer),
+			VM_HANDLER(op_add_const_1),
+			VM_HANDLER(op_add_const_2),
+			VM_HANDLER(op_add_const_4),
+			VM_HANDLER(op_add_const_8),
+			VM_HANDLER(op_negadd_const_1),
+			VM_HANDLER(op_negadd_const_2),
+			VM_HANDLER(op_negadd_const_4),
+			VM_HANDLER(op_negadd_const_8),
+			VM_HANDLER(op_mult_const_1),
+			VM_HANDLER(op_mult_const_2),
+			VM_HANDLER(op_mult_const_4),
+			VM_HANDLER(op_mult_const_8),
+			VM_HANDLER(op_checkbound),
+			VM_HANDLER(iter_begin),
+			VM_HANDLER(iter_next_1),
+			VM_HANDLER(iter_next_2),
+			VM_HANDLER(iter_end),
+			VM_HANDLER(loop_enter_1),
+			VM_HANDLER(loop_enter_2),
+			VM_HANDLER(loop_leave),
+			VM_HANDLER(arg_window),
+			VM_HANDLER(tail_call),
+			VM_HANDLER(tail_call_1),
+			VM_HANDLER(tail_call_2),
+			VM_HANDLER(tail_mcall_1),
+			VM_HANDLER(tail_mcall_2),
+			VM_HANDLER(switch_table_1),
+			VM_HANDLER(switch_table_2)
+		};
+		//build handler stream - it has same layout as the code, so the ip is still valid,
+		//only first byte of each instruction has handler. There is extra item at the end,
+		//which handles end of the block
+		std::vector<const void *> table(256, &&lbl_invalid);
+		for (const auto &x: handlerTable) table[static_cast<std::uint8_t>(x.first)] = x.second;
+		auto sz = block->code.size();
+		auto hs = std::make_shared<std::vector<const void *> >(sz+1, &&lbl_invalid);
+		std::size_t pos = 0;
+		while (pos < sz) {
+			Cmd cmd = static_cast<Cmd>(block->code[pos]);
+			(*hs)[pos] = table[block->code[pos]];
+			pos += 1 + getCmdOperandSize(cmd);
 		}
+		(*hs)[sz] = &&lbl_end;
+		handlers = hs;
+		std::atomic_store(&block->handlers, handlers);
+		return true;
+	}
+
+	const unsigned int batch = std::max(vm.get_batch_size(), 1U);
+	unsigned int budget = batch;
+	try {
+		goto *stream[ip++];
+#include "block_dispatch.h"
+	lbl_invalid:
+		invalid_instruction(vm, static_cast<Cmd>(block->code[ip-1]));
+		VM_NEXT();
+	lbl_end:
+		--ip;
+		vm.charge_steps(batch - budget);
+		return false;
+	dispatch_next:
+		//continue while there is budget and no task has been pushed or exception raised
+		if (--budget && vm.can_continue()) goto *stream[ip++];
+		vm.charge_steps(batch - budget);
 		return true;
 	} catch (...) {
+		vm.charge_steps(batch - budget);
 		vm.raise(std::current_exception());
 		return true;
 	}
+#undef VM_OP
+#undef VM_NEXT
+#undef VM_HANDLER
 }
 
+#endif
 
 bool BlockExecution::exception(VirtualMachine &vm, std::exception_ptr e) {
 	return false;
@@ -242,58 +556,58 @@ std::optional<CodeLocation> BlockExecution::getCodeLocation() const {
 	//ip points to next instruction, which can be also next line, so decrease ip by one
 	auto pos = ip;
 	if (pos) pos--;
-	auto iter = std::lower_bound(block.lines.begin(), block.lines.end(), std::pair{std::size_t(pos),std::size_t(-1)},std::greater());
+	auto iter = std::lower_bound(block->lines.begin(), block->lines.end(), std::pair{std::size_t(pos),std::size_t(-1)},std::greater());
 	std::size_t l;
-	if (iter == block.lines.end()) {
+	if (iter == block->lines.end()) {
 		l = 0;
 	} else {
 		l = iter->second;
 	}
 
-	return std::optional<CodeLocation>({block.location.file, block.location.line+l});
+	return std::optional<CodeLocation>({block->location.file, block->location.line+l});
 }
 
 std::intptr_t BlockExecution::load_int1() {
-	return static_cast<std::int8_t>(block.code[ip++]);
+	return static_cast<std::int8_t>(block->code[ip++]);
 }
 
 std::intptr_t BlockExecution::load_int2() {
-	std::intptr_t ret = static_cast<std::int8_t>(block.code[ip++]);
-	ret = ret * 256+static_cast<std::uint8_t>(block.code[ip++]);
+	std::intptr_t ret = static_cast<std::int8_t>(block->code[ip++]);
+	ret = ret * 256+static_cast<std::uint8_t>(block->code[ip++]);
 	return ret;
 
 }
 
 std::intptr_t BlockExecution::load_int4() {
-	std::intptr_t ret = static_cast<std::int8_t>(block.code[ip++]);
-	ret = ret * 256+static_cast<std::uint8_t>(block.code[ip++]);
-	ret = ret * 256+static_cast<std::uint8_t>(block.code[ip++]);
-	ret = ret * 256+static_cast<std::uint8_t>(block.code[ip++]);
+	std::intptr_t ret = static_cast<std::int8_t>(block->code[ip++]);
+	ret = ret * 256+static_cast<std::uint8_t>(block->code[ip++]);
+	ret = ret * 256+static_cast<std::uint8_t>(block->code[ip++]);
+	ret = ret * 256+static_cast<std::uint8_t>(block->code[ip++]);
 	return ret;
 }
 
 std::int64_t BlockExecution::load_int8() {
-	std::intptr_t ret = static_cast<std::int8_t>(block.code[ip++]);
-	ret = ret * 256+static_cast<std::uint8_t>(block.code[ip++]);
-	ret = ret * 256+static_cast<std::uint8_t>(block.code[ip++]);
-	ret = ret * 256+static_cast<std::uint8_t>(block.code[ip++]);
-	ret = ret * 256+static_cast<std::uint8_t>(block.code[ip++]);
-	ret = ret * 256+static_cast<std::uint8_t>(block.code[ip++]);
-	ret = ret * 256+static_cast<std::uint8_t>(block.code[ip++]);
-	ret = ret * 256+static_cast<std::uint8_t>(block.code[ip++]);
+	std::intptr_t ret = static_cast<std::int8_t>(block->code[ip++]);
+	ret = ret * 256+static_cast<std::uint8_t>(block->code[ip++]);
+	ret = ret * 256+static_cast<std::uint8_t>(block->code[ip++]);
+	ret = ret * 256+static_cast<std::uint8_t>(block->code[ip++]);
+	ret = ret * 256+static_cast<std::uint8_t>(block->code[ip++]);
+	ret = ret * 256+static_cast<std::uint8_t>(block->code[ip++]);
+	ret = ret * 256+static_cast<std::uint8_t>(block->code[ip++]);
+	ret = ret * 256+static_cast<std::uint8_t>(block->code[ip++]);
 	return ret;
 }
 
 double BlockExecution::load_double() {
-	double x = *reinterpret_cast<const double *>(block.code.data()+ip);
+	double x = *reinterpret_cast<const double *>(block->code.data()+ip);
 	ip+=8;
 	return x;
 }
 
 void BlockExecution::getVar(VirtualMachine &vm, std::intptr_t idx) {
-	Value name = block.consts[idx];
+	Value name = consts[idx];
 	Value out;
-	if (!vm.get_var(name.getString(), out)) {
+	if (!vm.get_var(Scope::Key(name, block->constHashes[idx]), out)) {
 		variable_not_found(vm, name.getString());
 	} else {
 		vm.push_value(out);
@@ -301,9 +615,9 @@ void BlockExecution::getVar(VirtualMachine &vm, std::intptr_t idx) {
 }
 
 Value BlockExecution::pickVar(VirtualMachine &vm, std::intptr_t idx) {
-	Value name = block.consts[idx];
+	Value name = consts[idx];
 	Value out;
-	if (!vm.get_var(name.getString(), out)) {
+	if (!vm.get_var(Scope::Key(name, block->constHashes[idx]), out)) {
 		variable_not_found(vm, name.getString());
 		return Value();
 	} else {
@@ -312,6 +626,23 @@ Value BlockExecution::pickVar(VirtualMachine &vm, std::intptr_t idx) {
 
 }
 
+void BlockExecution::load_local(VirtualMachine &vm, std::size_t depth, std::intptr_t slot) {
+	const Value &name = block->locals[slot];
+	Value out;
+	if (!vm.get_local(block_value, depth, slot, Scope::Key(name, block->localHashes[slot]), out)) {
+		variable_not_found(vm, name.getString());
+	} else {
+		vm.push_value(out);
+	}
+}
+
+void BlockExecution::store_local(VirtualMachine &vm, std::intptr_t slot) {
+	const Value &name = block->locals[slot];
+	if (!vm.set_local(block_value, slot, name, block->localHashes[slot], vm.top_value())) {
+		variable_already_assigned(vm, name.getString());
+	}
+}
+
 json::Value BlockExecution::deref(VirtualMachine &vm, Value src, Value idx) {
 	switch (idx.type()) {
 	case json::number: return src[idx.getUInt()];
@@ -349,6 +680,164 @@ void BlockExecution::deref(VirtualMachine &vm, Value idx) {
 	}
 }
 
+void BlockExecution::iter_begin(VirtualMachine &vm) {
+	IterState st;
+	st.container = vm.pop_value();
+	st.size = st.container.size();
+	if (st.container.type() == json::array) {
+		auto rng = dynamic_cast<const RangeValue *>(st.container.getHandle()->unproxy());
+		if (rng) {
+			st.kind = IterState::range;
+			st.base = rng->getBegin();
+			st.dir = rng->getDirection();
+		} else if (isProcArray(st.container)) {
+			st.kind = IterState::procarray;
+		}
+	}
+	iterStack.push_back(std::move(st));
+}
+
+void BlockExecution::iter_next(VirtualMachine &vm, std::intptr_t offset) {
+	if (iterStack.empty()) {
+		invalid_instruction(vm, Cmd::iter_next_1);
+		return;
+	}
+	IterState &st = iterStack.back();
+	if (st.index >= st.size) {
+		iterStack.pop_back();
+		ip += offset;
+		return;
+	}
+	auto idx = st.index++;
+	switch (st.kind) {
+		case IterState::range:
+			vm.push_value(intValue(st.base + st.dir * static_cast<json::Int>(idx)));
+			break;
+		case IterState::procarray:
+			vm.call_function(getProcArray(st.container).fn, Value(), intValue(idx));
+			break;
+		default:
+			vm.push_value(st.container[idx]);
+			break;
+	}
+}
+
+void BlockExecution::loop_enter(VirtualMachine &vm, std::intptr_t slot) {
+	if (vm.stack_size() < 2) {
+		invalid_instruction(vm, Cmd::loop_enter_1);
+		return;
+	}
+	vm.push_scope(vm.top_ref(1));
+	store_local(vm, slot);
+	vm.del_value();
+}
+
+void BlockExecution::loop_leave(VirtualMachine &vm) {
+	if (vm.stack_size() < 1) {
+		invalid_instruction(vm, Cmd::loop_leave);
+		return;
+	}
+	vm.top_ref() = vm.scope_to_object();
+	vm.pop_scope();
+}
+
+void BlockExecution::deref_cached(VirtualMachine &vm, const Value &idx) {
+	try {
+		Value z = vm.pop_value();
+		if (z.type() == json::array && isProcArray(z)) {
+			const ProcArray &pa = getProcArray(z);
+			vm.call_function(pa.fn, Value(), idx);
+		} else {
+			vm.push_value(cached_deref(vm, z, idx));
+		}
+	} catch (...) {
+		vm.raise(std::current_exception());
+	}
+}
+
+void BlockExecution::mcall_cached(VirtualMachine &vm, const Value &method) {
+	Value obj = vm.pop_call_object();
+	Value m = cached_deref(vm, obj, method);
+	vm.call_function_raw(m,obj);
+}
+
+bool BlockExecution::tail_call(VirtualMachine &, const Value &, const Value &) {
+	return false;
+}
+
+void BlockExecution::do_tail_call(VirtualMachine &vm, const Value &fnval, const Value &object) {
+	if (!tail_call(vm, fnval, object)) vm.call_function_raw(fnval, object);
+}
+
+void BlockExecution::tail_mcall_cached(VirtualMachine &vm, const Value &method) {
+	Value obj = vm.pop_call_object();
+	Value m = cached_deref(vm, obj, method);
+	do_tail_call(vm, m, obj);
+}
+
+void BlockExecution::restart(Value block) {
+	if (block_value.getHandle() != block.getHandle()) {
+		block_value = block;
+		this->block = &getBlockFromValue(block_value);
+		consts = this->block->consts.data();
+		pinnedConsts.reset();
+		handlers.reset();
+		//entries of the cache are addressed by ip
+		derefCache.reset();
+	}
+	iterStack.clear();
+	ip = 0;
+}
+
+Value BlockExecution::cached_deref(VirtualMachine &vm, const Value &src, const Value &idx) {
+	if (idx.type() != json::string) return deref(vm, src, idx);
+	if (!derefCache) derefCache = std::make_unique<DerefCacheEntry[]>(derefCacheSize);
+	DerefCacheEntry &e = derefCache[ip % derefCacheSize];
+	auto epoch = vm.getClassEpoch();
+	auto name = idx.getString();
+	if (src.type() == json::object) {
+		//objects are immutable, so result depends on identity of the object
+		const void *key = src.getHandle().get();
+		if (e.site == ip && e.key == key && (!e.useEpoch || e.epoch == epoch)) {
+			return e.result;
+		}
+		Value r = src[name];
+		bool useEpoch = false;
+		if (!r.defined()) {
+			Value clsItem = src[""];
+			if (clsItem.type() != json::object) {
+				useEpoch = true;
+				if (!vm.get_var(getTypeClass(src), clsItem)) clsItem = Value();
+			}
+			r = clsItem[name];
+		}
+		e.site = ip;
+		e.key = key;
+		e.keep = src;
+		e.result = r;
+		e.epoch = epoch;
+		e.useEpoch = useEpoch;
+		return r;
+	} else {
+		//other types - result depends on type class
+		auto cls = getTypeClass(src);
+		const void *key = cls.data();
+		if (e.site == ip && e.key == key && e.epoch == epoch) {
+			return e.result;
+		}
+		Value clsItem;
+		if (!vm.get_var(cls, clsItem)) clsItem = Value();
+		Value r = clsItem[name];
+		e.site = ip;
+		e.key = key;
+		e.keep = Value();
+		e.result = r;
+		e.epoch = epoch;
+		e.useEpoch = true;
+		return r;
+	}
+}
+
 void BlockExecution::bin_op_const(VirtualMachine &vm, std::int64_t val, Value (*fn)(const Value &a, const Value &b)) {
 	Value z = vm.pop_value();
 	vm.push_value(fn(z,val));
@@ -356,7 +845,7 @@ void BlockExecution::bin_op_const(VirtualMachine &vm, std::int64_t val, Value (*
 
 void BlockExecution::op_cmp_const(VirtualMachine &vm, int idx) {
 	Value z = vm.top_value();
-	Value v = block.consts[idx];
+	Value v = consts[idx];
 	if (v == z) {
 		vm.del_value();
 		vm.push_value(true);
@@ -377,7 +866,7 @@ Value BlockExecution::op_checkbound(const Value &a, const Value &b) {
 }
 
 void BlockExecution::mcall_fn(VirtualMachine &vm, Value method) {
-	Value obj = vm.pop_value();
+	Value obj = vm.pop_call_object();
 	Value m = deref(vm, obj, method);
 	vm.call_function_raw(m,obj);
 }
@@ -444,6 +933,15 @@ void BlockExecution::exec_block(VirtualMachine &vm) {
 	}
 }
 
+void BlockExecution::switch_table(VirtualMachine &vm, std::intptr_t cindex) {
+	const SwitchTable &tbl = getSwitchTableFromValue(consts[cindex]);
+	auto trg = tbl.find(vm.top_value());
+	if (trg != SwitchTable::npos) {
+		vm.del_value();
+		ip = trg;
+	}
+}
+
 void BlockExecution::do_raise(VirtualMachine &vm) {
 	Value e = vm.pop_value();
 	vm.raise(std::make_exception_ptr(CustomVMException(e)));
@@ -451,7 +949,7 @@ void BlockExecution::do_raise(VirtualMachine &vm) {
 
 
 void BlockExecution::set_var(VirtualMachine &vm, std::intptr_t cindex) {
-	Value trg = block.consts[cindex];
+	Value trg = consts[cindex];
 	if (trg.type() == json::array) {
 		auto args = vm.top_params();
 		int idx = 0;
@@ -467,9 +965,9 @@ void BlockExecution::set_var(VirtualMachine &vm, std::intptr_t cindex) {
 		}
 	} else {
 		Value v = vm.top_value();
-		auto name = block.consts[cindex].getString();
-		if (!vm.set_var(name, v)) {
-			variable_already_assigned(vm, name);
+		const Value &name = consts[cindex];
+		if (!vm.set_var(name, block->constHashes[cindex], v)) {
+			variable_already_assigned(vm, name.getString());
 		}
 	}
 }
@@ -485,7 +983,71 @@ void BlockExecution::unar_op(VirtualMachine &vm, Value (*fn)(const Value &a)) {
 	vm.push_value(fn(a));
 }
 
+bool BlockExecution::eval_const(Cmd cmd, const Value &a, const Value &b, Value &out) {
+	auto cmp = [&]{
+		//same as op_cmp
+		if (a.type() == json::number && b.type() == json::number) {
+			if (isIntNumber(a) && isIntNumber(b)) {
+				auto av = a.getIntLong();
+				auto bv = b.getIntLong();
+				return av < bv?-1:av > bv?1:0;
+			} else {
+				auto av = a.getNumber();
+				auto bv = b.getNumber();
+				return av < bv?-1:av > bv?1:0;
+			}
+		}
+		return Value::compare(a, b);
+	};
+	switch (cmd) {
+		case Cmd::op_add: out = op_add(a,b);break;
+		case Cmd::op_sub: out = op_sub(a,b);break;
+		case Cmd::op_mult: out = op_mult(a,b);break;
+		case Cmd::op_div: out = op_div(a,b);break;
+		case Cmd::op_mod: if (isIntNumber(a) && isIntNumber(b) && b.getIntLong() == 0) return false;
+						  out = op_mod(a,b);break;
+		case Cmd::op_power: out = op_power(a,b);break;
+		case Cmd::op_cmp_eq: out = cmp() == 0;break;
+		case Cmd::op_cmp_not_eq: out = cmp() != 0;break;
+		case Cmd::op_cmp_less: out = cmp() < 0;break;
+		case Cmd::op_cmp_greater: out = cmp() > 0;break;
+		case Cmd::op_cmp_less_eq: out = cmp() <= 0;break;
+		case Cmd::op_cmp_greater_eq: out = cmp() >= 0;break;
+		default: return false;
+	}
+	return true;
+}
+
+bool BlockExecution::eval_const(Cmd cmd, const Value &a, Value &out) {
+	switch (cmd) {
+		case Cmd::op_bool_not: out = op_not(a);break;
+		case Cmd::op_unary_minus: out = op_unar_minus(a);break;
+		default: return false;
+	}
+	return true;
+}
+
 void BlockExecution::op_cmp(VirtualMachine &vm, bool (*fn)(int z)) {
+	if (vm.stack_size() >= 2) {
+		//fast path for numbers
+		Value &b = vm.top_ref(0);
+		Value &a = vm.top_ref(1);
+		if (a.type() == json::number && b.type() == json::number) {
+			int r;
+			if (isIntNumber(a) && isIntNumber(b)) {
+				auto av = a.getIntLong();
+				auto bv = b.getIntLong();
+				r = av < bv?-1:av > bv?1:0;
+			} else {
+				auto av = a.getNumber();
+				auto bv = b.getNumber();
+				r = av < bv?-1:av > bv?1:0;
+			}
+			a = Value(fn(r));
+			vm.del_value();
+			return;
+		}
+	}
 	Value b = vm.pop_value();
 	Value a = vm.pop_value();
 	vm.push_value(fn(Value::compare(a, b)));
@@ -712,7 +1274,7 @@ void BlockExecution::do_isdef(VirtualMachine &vm, std::intptr_t idx) {
 		vm.raise(std::make_exception_ptr(std::runtime_error("Compile time")));
 	} else {
 		Value dummy;
-		vm.push_value(vm.get_var(block.consts[idx].getString(), dummy));
+		vm.push_value(vm.get_var(Scope::Key(consts[idx], block->constHashes[idx]), dummy));
 	}
 }
 
@@ -12,7 +12,10 @@
 #define SRC_MSCRIPT_BLOCK_H_
 
 
+#include <memory>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include "vm.h"
 #include "exceptions.h"
 
@@ -76,6 +79,15 @@ enum class Cmd:std::uint8_t{
 	is_def_1,			///<pick name of varuable, put on stack result (true if defined)
 	is_def_2,			///<pick name of varuable, put on stack result (true if defined)
 
+	// local variables resolved to slots (see Block::locals)
+	load_local_1,		///<push value of local variable, slot index 1 byte
+	load_local_2,		///<push value of local variable, slot index 2 bytes
+	store_local_1,		///<set local variable, slot index 1 byte
+	store_local_2,		///<set local variable, slot index 2 bytes
+	pop_local_1,		///<set local variable and remove value from stack, slot index 1 byte
+	pop_local_2,		///<set local variable and remove value from stack, slot index 2 bytes
+	load_outer,			///<push value of local variable of enclosing scope, operand: depth (1 byte), slot index (1 byte)
+
 	// operations
 
 	op_add,
@@ -124,23 +136,167 @@ enum class Cmd:std::uint8_t{
 
 	// loops
 
+	iter_begin,		///<<container> - consumes container and starts its iteration (see iter_next)
+	iter_next_1,	///<pushes next item of the iterated container, or finishes iteration and jumps if there are no more items
+	iter_next_2,	///<pushes next item of the iterated container, or finishes iteration and jumps if there are no more items
+	iter_end,		///<finishes iteration (used by break)
+
+	// superinstructions (generated by optimizer, see optimizer.h)
+
+	loop_enter_1,	///<<scope><value> - creates scope with base <scope> and stores <value> to local variable, leaves <scope> (dup_1 1, push_scope_object, pop_local_1)
+	loop_enter_2,	///<<scope><value> - creates scope with base <scope> and stores <value> to local variable, leaves <scope> (dup_1 1, push_scope_object, pop_local_2)
+	loop_leave,		///<<scope> - replaces <scope> by object of the toplevel scope and destroys the scope (scope_to_object, pop_scope, swap, del)
+
+	// calls
+
+	arg_window,		///<<args...> - marks count of values on top of the stack as arguments of the next call (they are not packed)
+	tail_call,			///<same as call, but the call is the last action of the block (see BlockExecution::tail_call)
+	tail_call_1,		///<same as call_1, but the call is the last action of the block
+	tail_call_2,		///<same as call_2, but the call is the last action of the block
+	tail_mcall_1,		///<same as mcall_1, but the call is the last action of the block
+	tail_mcall_2,		///<same as mcall_2, but the call is the last action of the block
+
+	// switch
+
+	switch_table_1,		///<<selector> - looks up selector in the jump table (see SwitchTable), consumes selector and jumps, when found
+	switch_table_2,		///<<selector> - looks up selector in the jump table (see SwitchTable), consumes selector and jumps, when found
 
 };
 
 
+///Mnemonics of the instructions (used by disassembler only, see getCmdOperand)
 extern json::NamedEnum<Cmd> strCmd;
 
+///Kind of the operand of the instruction
+enum class OperandKind: std::uint8_t {
+	none,		///<instruction has no operand
+	immediate,	///<value is stored in the operand (number, count)
+	constant,	///<index of a constant (see Block::consts)
+	local,		///<slot of a local variable (see Block::locals)
+	outer,		///<depth of the scope (high byte) and slot of a local variable (low byte), see load_outer
+	jump		///<relative jump, counted from the end of the instruction
+};
+
+///Describes operand of the instruction
+struct CmdOperand {
+	///size of the operand in bytes
+	std::uint8_t size;
+	///kind of the operand
+	OperandKind kind;
+};
+
+///Retrieves operand of the instruction
+/**
+ * This is the only place, which defines encoding of the operands. Operands of 1 and 2 bytes
+ * are signed (see BlockExecution::load_int1, load_int2)
+ */
+constexpr CmdOperand getCmdOperand(Cmd cmd) {
+	switch (cmd) {
+		case Cmd::push_int_1: return {1, OperandKind::immediate};
+		case Cmd::push_int_2: return {2, OperandKind::immediate};
+		case Cmd::push_int_4: return {4, OperandKind::immediate};
+		case Cmd::push_int_8: return {8, OperandKind::immediate};
+		case Cmd::push_double: return {8, OperandKind::immediate};
+		case Cmd::push_const_1: return {1, OperandKind::constant};
+		case Cmd::push_const_2: return {2, OperandKind::constant};
+		case Cmd::collapse_list_1: return {1, OperandKind::immediate};
+		case Cmd::dup_1: return {1, OperandKind::immediate};
+		case Cmd::swap_1: return {1, OperandKind::immediate};
+		case Cmd::get_var_1: return {1, OperandKind::constant};
+		case Cmd::get_var_2: return {2, OperandKind::constant};
+		case Cmd::deref_1: return {1, OperandKind::constant};
+		case Cmd::deref_2: return {2, OperandKind::constant};
+		case Cmd::call_1: return {1, OperandKind::constant};
+		case Cmd::call_2: return {2, OperandKind::constant};
+		case Cmd::mcall_1: return {1, OperandKind::constant};
+		case Cmd::mcall_2: return {2, OperandKind::constant};
+		case Cmd::push_array_1: return {1, OperandKind::immediate};
+		case Cmd::push_array_2: return {2, OperandKind::immediate};
+		case Cmd::push_array_4: return {4, OperandKind::immediate};
+		case Cmd::set_var_1: return {1, OperandKind::constant};
+		case Cmd::set_var_2: return {2, OperandKind::constant};
+		case Cmd::pop_var_1: return {1, OperandKind::constant};
+		case Cmd::pop_var_2: return {2, OperandKind::constant};
+		case Cmd::is_def_1: return {1, OperandKind::constant};
+		case Cmd::is_def_2: return {2, OperandKind::constant};
+		case Cmd::load_local_1: return {1, OperandKind::local};
+		case Cmd::load_local_2: return {2, OperandKind::local};
+		case Cmd::store_local_1: return {1, OperandKind::local};
+		case Cmd::store_local_2: return {2, OperandKind::local};
+		case Cmd::pop_local_1: return {1, OperandKind::local};
+		case Cmd::pop_local_2: return {2, OperandKind::local};
+		case Cmd::load_outer: return {2, OperandKind::outer};
+		case Cmd::op_cmp_eq_1: return {1, OperandKind::constant};
+		case Cmd::op_cmp_eq_2: return {2, OperandKind::constant};
+		case Cmd::op_add_const_1: return {1, OperandKind::immediate};
+		case Cmd::op_add_const_2: return {2, OperandKind::immediate};
+		case Cmd::op_add_const_4: return {4, OperandKind::immediate};
+		case Cmd::op_add_const_8: return {8, OperandKind::immediate};
+		case Cmd::op_negadd_const_1: return {1, OperandKind::immediate};
+		case Cmd::op_negadd_const_2: return {2, OperandKind::immediate};
+		case Cmd::op_negadd_const_4: return {4, OperandKind::immediate};
+		case Cmd::op_negadd_const_8: return {8, OperandKind::immediate};
+		case Cmd::op_mult_const_1: return {1, OperandKind::immediate};
+		case Cmd::op_mult_const_2: return {2, OperandKind::immediate};
+		case Cmd::op_mult_const_4: return {4, OperandKind::immediate};
+		case Cmd::op_mult_const_8: return {8, OperandKind::immediate};
+		case Cmd::jump_1: return {1, OperandKind::jump};
+		case Cmd::jump_2: return {2, OperandKind::jump};
+		case Cmd::jump_true_1: return {1, OperandKind::jump};
+		case Cmd::jump_true_2: return {2, OperandKind::jump};
+		case Cmd::jump_false_1: return {1, OperandKind::jump};
+		case Cmd::jump_false_2: return {2, OperandKind::jump};
+		case Cmd::iter_next_1: return {1, OperandKind::jump};
+		case Cmd::iter_next_2: return {2, OperandKind::jump};
+		case Cmd::loop_enter_1: return {1, OperandKind::local};
+		case Cmd::loop_enter_2: return {2, OperandKind::local};
+		case Cmd::arg_window: return {1, OperandKind::immediate};
+		case Cmd::tail_call_1: return {1, OperandKind::constant};
+		case Cmd::tail_call_2: return {2, OperandKind::constant};
+		case Cmd::tail_mcall_1: return {1, OperandKind::constant};
+		case Cmd::tail_mcall_2: return {2, OperandKind::constant};
+		case Cmd::switch_table_1: return {1, OperandKind::constant};
+		case Cmd::switch_table_2: return {2, OperandKind::constant};
+		default: return {0, OperandKind::none};
+	}
+}
+
+///Retrieves size of the operand of the instruction in bytes
+constexpr std::size_t getCmdOperandSize(Cmd cmd) {
+	return getCmdOperand(cmd).size;
+}
+
+#if defined(__GNUC__) && !defined(MSCRIPT_NO_THREADED_DISPATCH)
+///Threaded dispatch is available (requires labels as values)
+#define MSCRIPT_THREADED_DISPATCH
+#endif
+
 
 struct Block {
 public:
+	static constexpr std::size_t npos = static_cast<std::size_t>(-1);
 	///constants - pushed from code to stack
 	std::vector<Value> consts;
+	///names of local variables - index is slot number used by load_local/store_local
+	std::vector<Value> locals;
+	///precomputed hashes of string constants (names of variables), zero for other constants
+	std::vector<std::size_t> constHashes;
+	///precomputed hashes of names of local variables
+	std::vector<std::size_t> localHashes;
+	///hash table of local variables - contains slot+1, zero is empty item. Size is power of two
+	std::vector<std::uint32_t> localIndex;
 	///code
 	std::vector<std::uint8_t> code;
 	///Addresses map to lines - for debugging
 	std::vector<std::pair<std::size_t,std::size_t>> lines; //{code, line, ordered backward}
 
 	CodeLocation location;
+	///Pre-decoded handler stream for threaded dispatch, created on first execution
+	/**
+	 * Stream has same layout as the code, each instruction has pointer to its handler.
+	 * Use std::atomic_load/atomic_store to access this field
+	 */
+	mutable std::shared_ptr<const std::vector<const void *> > handlers;
 
 	enum class DisEvent {
 		code,
@@ -151,6 +307,15 @@ public:
 		location,
 	};
 
+	///Calculates constHashes, localHashes and localIndex, must be called when the block is built
+	void hashNames();
+	///Finds slot of local variable by its name
+	/**
+	 * @param name name of variable
+	 * @return slot index or npos if the variable has no slot in this block
+	 */
+	std::size_t findLocal(const Scope::Key &name) const;
+
 	template<typename Fn> void disassemble(Fn &&fn) const;
 	template<typename Fn> void disassemble_ip(std::size_t ip, Fn &&fn) const;
 	template<typename Fn> void disassemble_iter(std::vector<std::uint8_t>::const_iterator &iter, const std::vector<std::uint8_t>::const_iterator &end, Fn &&fn) const;
@@ -168,6 +333,74 @@ static inline const Block &getBlockFromValue(const Value &v) {
 	return json::cast<Block>(v);
 }
 
+///Jump table of the instruction switch_table
+/**
+ * The table is stored as a constant of the block. It maps constant labels to positions
+ * in the code. String labels are looked up through a hash table, integer labels are looked
+ * up through a dense table indexed by value of the label. Other labels are not supported, such
+ * switch is compiled as a sequence of comparisons
+ */
+class SwitchTable {
+public:
+	static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+	///Minimal count of labels to create the table
+	static constexpr std::size_t minLabels = 4;
+	///Maximal size of the dense table
+	static constexpr std::size_t maxDenseSize = 256;
+
+	///Creates the table
+	/**
+	 * @param labels labels of the switch
+	 * @param targets positions in the code, one for each label
+	 * @exception BuildError labels are not suitable for the table (see isSuitable)
+	 */
+	SwitchTable(std::vector<Value> labels, std::vector<std::size_t> targets);
+	SwitchTable(const SwitchTable &other):SwitchTable(other.labels, other.targets) {}
+	SwitchTable(SwitchTable &&other) = default;
+	SwitchTable &operator=(const SwitchTable &other) = delete;
+
+	///Determines, whether the switch with given labels can be compiled to the table
+	static bool isSuitable(const std::vector<Value> &labels);
+
+	///Finds target for the selector
+	/**
+	 * @param v selector
+	 * @return position in the code, or npos, if there is no such label
+	 */
+	std::size_t find(const Value &v) const;
+
+	const std::vector<Value> &getLabels() const {return labels;}
+	const std::vector<std::size_t> &getTargets() const {return targets;}
+
+protected:
+	std::vector<Value> labels;
+	std::vector<std::size_t> targets;
+	///value of the first item of the dense table
+	json::Int base = 0;
+	///dense table for integer labels - contains index of the label, or npos
+	std::vector<std::size_t> dense;
+	///hash table for string labels - keys reference strings of the labels
+	std::unordered_map<std::string_view, std::size_t> hashed;
+
+	static bool isIntLabel(const Value &v);
+};
+
+static inline Value packToValue(SwitchTable &&table) {
+	//content describes whole table, so equal tables are merged in constants of the block
+	Value content = {"@SWITCH",
+			Value(json::array, table.getLabels().begin(), table.getLabels().end(), [](const Value &x){return x;}),
+			Value(json::array, table.getTargets().begin(), table.getTargets().end(), [](std::size_t x){return Value(static_cast<std::uint64_t>(x));})};
+	return json::makeValue(std::move(table), content);
+}
+
+static inline bool isSwitchTable(const Value &v) {
+	return isNativeType(v, typeid(SwitchTable));
+}
+
+static inline const SwitchTable &getSwitchTableFromValue(const Value &v) {
+	return json::cast<SwitchTable>(v);
+}
+
 
 class BlockExecution: public AbstractTask {
 public:
@@ -179,14 +412,105 @@ public:
 	virtual bool exception(VirtualMachine &vm, std::exception_ptr e);
 	virtual std::optional<CodeLocation> getCodeLocation() const;
 
-	const Block &getBlock() const {return block;}
+	const Block &getBlock() const {return *block;}
 	std::size_t getIP() const {return ip;}
 
+	///Evaluates binary operation on constants (used by constant folding)
+	/**
+	 * Result is same as result of the instruction executed by the virtual machine
+	 * @param cmd instruction (op_add, op_cmp_eq, etc)
+	 * @param a first operand
+	 * @param b second operand
+	 * @param out result
+	 * @retval true evaluated
+	 * @retval false the instruction is not supported
+	 */
+	static bool eval_const(Cmd cmd, const Value &a, const Value &b, Value &out);
+	///Evaluates unary operation on constant (op_bool_not, op_unary_minus)
+	static bool eval_const(Cmd cmd, const Value &a, Value &out);
+
 protected:
+
+	///Called for a call in tail position (tail_call, tail_mcall)
+	/**
+	 * Allows to replace execution of the current block by execution of the called function.
+	 * Default implementation doesn't support it
+	 *
+	 * @param vm virtual machine
+	 * @param fnval function to call
+	 * @param object object (for methods)
+	 * @retval true tail call accepted, current block must finish
+	 * @retval false tail call is not possible, the function is called as usual
+	 */
+	virtual bool tail_call(VirtualMachine &vm, const Value &fnval, const Value &object);
+	///Replaces executed block, execution starts from the beginning (init must be called)
+	void restart(Value block);
+
 	Value block_value;
-	const Block &block;
+	const Block *block;
+	///constants of the block (can be pinned, see VirtualMachine::pin_consts)
+	const Value *consts;
+	///holds pinned constants
+	std::shared_ptr<const std::vector<Value> > pinnedConsts;
 	///Instruction pointer
 	std::size_t ip = 0;
+	///Handler stream when threaded dispatch is used
+	std::shared_ptr<const std::vector<const void *> > handlers;
+
+	///Inline cache entry for member lookups (deref_1, mcall_1)
+	struct DerefCacheEntry {
+		///instruction site (ip after the instruction), 0 - empty
+		std::size_t site = 0;
+		///identity of object or type class
+		const void *key = nullptr;
+		///keeps object alive, so its identity cannot be reused
+		Value keep;
+		///cached result
+		Value result;
+		///class epoch when result was resolved through the type class
+		unsigned int epoch = 0;
+		///result was resolved through the type class, so it depends on class epoch
+		bool useEpoch = false;
+	};
+	static constexpr std::size_t derefCacheSize = 32;
+	///Inline cache - allocated on first use, entries are direct mapped by instruction site
+	std::unique_ptr<DerefCacheEntry[]> derefCache;
+
+	///State of native iteration (iter_begin, iter_next)
+	struct IterState {
+		enum Kind {
+			///container is range, items are calculated
+			range,
+			///container is procedural array, items are returned by a function
+			procarray,
+			///items are retrieved by index
+			items
+		};
+		///iterated container
+		Value container;
+		///index of next item
+		std::size_t index = 0;
+		///count of items
+		std::size_t size = 0;
+		///first value of range
+		json::Int base = 0;
+		///direction of range
+		json::Int dir = 1;
+		Kind kind = items;
+	};
+	///Stack of active iterations - nested loops
+	std::vector<IterState> iterStack;
+
+	bool dispatch_switch(VirtualMachine &vm);
+#ifdef MSCRIPT_THREADED_DISPATCH
+	///Threaded dispatch loop
+	/**
+	 * @param vm virtual machine
+	 * @param stream handler stream. If nullptr is passed, function only builds the
+	 * handler stream for current block
+	 */
+	bool dispatch_threaded(VirtualMachine &vm, const void * const *stream);
+#endif
 
 
 	std::intptr_t load_int1();
@@ -197,11 +521,36 @@ protected:
 
 	void getVar(VirtualMachine &vm, std::intptr_t idx);
 	Value pickVar(VirtualMachine &vm, std::intptr_t idx);
+	///Pushes local variable
+	/**
+	 * @param depth count of scopes between the current scope and the scope of the variable
+	 * (see BlockBld::resolveLocal)
+	 * @param slot slot of the variable
+	 */
+	void load_local(VirtualMachine &vm, std::size_t depth, std::intptr_t slot);
+	void store_local(VirtualMachine &vm, std::intptr_t slot);
 	void deref(VirtualMachine &vm, Value idx);
+	void iter_begin(VirtualMachine &vm);
+	void iter_next(VirtualMachine &vm, std::intptr_t offset);
+	///Enters next iteration of the for loop (loop_enter_1, loop_enter_2)
+	void loop_enter(VirtualMachine &vm, std::intptr_t slot);
+	///Leaves iteration of the loop (loop_leave)
+	void loop_leave(VirtualMachine &vm);
 	json::Value deref(VirtualMachine &vm, Value src, Value idx);
 	void call_fn(VirtualMachine &vm);
 	void mcall_fn(VirtualMachine &vm, Value method);
+	///Dereference with inline cache (deref_1, deref_2)
+	void deref_cached(VirtualMachine &vm, const Value &idx);
+	///Method call with inline cache (mcall_1, mcall_2)
+	void mcall_cached(VirtualMachine &vm, const Value &method);
+	///Call in tail position
+	void do_tail_call(VirtualMachine &vm, const Value &fnval, const Value &object);
+	///Method call in tail position with inline cache (tail_mcall_1, tail_mcall_2)
+	void tail_mcall_cached(VirtualMachine &vm, const Value &method);
+	Value cached_deref(VirtualMachine &vm, const Value &src, const Value &idx);
 	void exec_block(VirtualMachine &vm);
+	///Looks up selector in the jump table, the table is stored in constants
+	void switch_table(VirtualMachine &vm, std::intptr_t cindex);
 	void do_raise(VirtualMachine &vm);
 	void set_var(VirtualMachine &vm, std::intptr_t cindex);
 
@@ -210,6 +559,15 @@ protected:
 	void op_cmp(VirtualMachine &vm, bool (*fn)(int z));
 	void op_cmp_const(VirtualMachine &vm, int idx);
 	void bin_op_const(VirtualMachine &vm, std::int64_t val, Value (*fn)(const Value &a, const Value &b));
+	///Binary operation with fast path for numbers (result replaces operands in place)
+	/**
+	 * @tparam Op numeric operation (see block.cpp)
+	 * @param fn generic operation - used when operands are not numbers
+	 */
+	template<typename Op> void num_op(VirtualMachine &vm, Value (*fn)(const Value &a, const Value &b));
+	///Binary operation with constant with fast path for numbers
+	template<typename Op> void num_op_const(VirtualMachine &vm, std::int64_t val, Value (*fn)(const Value &a, const Value &b));
+	void negadd_const(VirtualMachine &vm, std::int64_t val);
 
 	void expand_param_pack(VirtualMachine &, std::intptr_t amount);
 
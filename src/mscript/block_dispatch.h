@@ -0,0 +1,131 @@
+/*
+ * block_dispatch.h
+ *
+ *  Created on: 18. 10. 2026
+ *      Author: ondra
+ */
+
+//NOTE: This file has no include guard. It contains bodies of all instructions
+//and it is included by block.cpp into both dispatch loops of the BlockExecution
+//(switch dispatch and threaded dispatch).
+//
+//Following macros must be defined before the file is included
+//
+//VM_OP(x)   - declares label of the instruction x
+//VM_NEXT()  - finishes current instruction and dispatches next one
+//
+//Every instruction must end with VM_NEXT(). When new instruction is added, it must be
+//also registered in the handler table of BlockExecution::dispatch_threaded
+
+	VM_OP(noop): VM_NEXT();
+	VM_OP(push_int_1): vm.push_value(intValue(load_int1()));VM_NEXT();
+	VM_OP(push_int_2): vm.push_value(intValue(load_int2()));VM_NEXT();
+	VM_OP(push_int_4): vm.push_value(intValue(load_int4()));VM_NEXT();
+	VM_OP(push_int_8): vm.push_value(intValue(load_int8()));VM_NEXT();
+	VM_OP(push_double): vm.push_value(load_double());VM_NEXT();
+	VM_OP(push_const_1): vm.push_value(consts[load_int1()]);VM_NEXT();
+	VM_OP(push_const_2): vm.push_value(consts[load_int2()]);VM_NEXT();
+	VM_OP(begin_list): vm.begin_list();VM_NEXT();
+	VM_OP(close_list): vm.finish_list();VM_NEXT();
+	VM_OP(expand_array): vm.push_values(vm.pop_value());VM_NEXT();
+	VM_OP(collapse_list_1): vm.collapse_param_pack();vm.push_value(vm.pop_value().slice(load_int1()));VM_NEXT();
+	VM_OP(dup): vm.dup_value();VM_NEXT();
+	VM_OP(dup_1): vm.dup_value(load_int1());VM_NEXT();
+	VM_OP(vlist_pop): vlist_pop(vm);VM_NEXT();
+	VM_OP(combine): combine_results(vm);VM_NEXT();
+	VM_OP(del): vm.del_value();VM_NEXT();
+	VM_OP(swap): vm.swap_value();VM_NEXT();
+	VM_OP(swap_1): vm.swap_value(load_int1());VM_NEXT();
+	VM_OP(get_var_1): getVar(vm,load_int1());VM_NEXT();
+	VM_OP(get_var_2): getVar(vm,load_int2());VM_NEXT();
+	VM_OP(deref): deref(vm,vm.pop_value());VM_NEXT();
+	VM_OP(deref_1): deref_cached(vm,consts[load_int1()]);VM_NEXT();
+	VM_OP(deref_2): deref_cached(vm,consts[load_int2()]);VM_NEXT();
+	VM_OP(call): vm.call_function_raw(vm.pop_value(),Value());VM_NEXT();
+	VM_OP(call_1): vm.call_function_raw(pickVar(vm, load_int1()),Value());VM_NEXT();
+	VM_OP(call_2): vm.call_function_raw(pickVar(vm, load_int2()),Value());VM_NEXT();
+	VM_OP(mcall): {Value fnval=vm.pop_value();vm.call_function_raw(fnval,vm.pop_value());};VM_NEXT();
+	VM_OP(mcall_1): mcall_cached(vm,consts[load_int1()]);VM_NEXT();
+	VM_OP(mcall_2): mcall_cached(vm,consts[load_int2()]);VM_NEXT();
+	VM_OP(exec_block): exec_block(vm);VM_NEXT();
+	VM_OP(push_scope): vm.push_scope(Value());VM_NEXT();
+	VM_OP(pop_scope): vm.pop_scope();VM_NEXT();
+	VM_OP(push_scope_object): vm.push_scope(vm.pop_value());VM_NEXT();
+	VM_OP(scope_to_object): vm.push_value(vm.scope_to_object());VM_NEXT();
+	VM_OP(raise): do_raise(vm);VM_NEXT();
+	VM_OP(set_var_1): set_var(vm,load_int1());VM_NEXT();
+	VM_OP(set_var_2): set_var(vm,load_int2());VM_NEXT();
+	VM_OP(pop_var_1): set_var(vm,load_int1());vm.del_value();VM_NEXT();
+	VM_OP(pop_var_2): set_var(vm,load_int2());vm.del_value();VM_NEXT();
+	VM_OP(op_add): num_op<NumAdd>(vm,op_add);VM_NEXT();
+	VM_OP(op_sub): num_op<NumSub>(vm,op_sub);VM_NEXT();
+	VM_OP(op_mult): num_op<NumMult>(vm,op_mult);VM_NEXT();
+	VM_OP(op_div): bin_op(vm,op_div);VM_NEXT();
+	VM_OP(op_mod): num_op<NumMod>(vm,op_mod);VM_NEXT();
+	VM_OP(op_cmp_eq): op_cmp(vm,[](int x){return x == 0;});VM_NEXT();
+	VM_OP(op_cmp_less): op_cmp(vm,[](int x){return x < 0;});VM_NEXT();
+	VM_OP(op_cmp_greater): op_cmp(vm,[](int x){return x > 0;});VM_NEXT();
+	VM_OP(op_cmp_less_eq): op_cmp(vm,[](int x){return x <= 0;});VM_NEXT();
+	VM_OP(op_cmp_greater_eq): op_cmp(vm,[](int x){return x >= 0;});VM_NEXT();
+	VM_OP(op_cmp_not_eq): op_cmp(vm,[](int x){return x != 0;});VM_NEXT();
+	VM_OP(op_cmp_eq_1): op_cmp_const(vm,load_int1());VM_NEXT();
+	VM_OP(op_cmp_eq_2): op_cmp_const(vm,load_int2());VM_NEXT();
+	VM_OP(op_bool_and): bin_op(vm,op_and);VM_NEXT();
+	VM_OP(op_bool_or): bin_op(vm,op_or);VM_NEXT();
+	VM_OP(op_bool_not): unar_op(vm,op_not);VM_NEXT();
+	VM_OP(op_power): bin_op(vm,op_power);VM_NEXT();
+	VM_OP(jump_1): ip+=load_int1();VM_NEXT();
+	VM_OP(jump_2): ip+=load_int2();VM_NEXT();
+	VM_OP(jump_true_1): ip+=load_int1() * (vm.pop_value().getBool()?1:0);VM_NEXT();
+	VM_OP(jump_true_2): ip+=load_int2() * (vm.pop_value().getBool()?1:0);VM_NEXT();
+	VM_OP(jump_false_1): ip+=load_int1() * (vm.pop_value().getBool()?0:1);VM_NEXT();
+	VM_OP(jump_false_2): ip+=load_int2() * (vm.pop_value().getBool()?0:1);VM_NEXT();
+	VM_OP(exit_block): ip = block->code.size();VM_NEXT();
+	VM_OP(push_false): vm.push_value(false);VM_NEXT();
+	VM_OP(push_true): vm.push_value(true);VM_NEXT();
+	VM_OP(push_null): vm.push_value(nullptr);VM_NEXT();
+	VM_OP(push_zero_int): vm.push_value(intValue(0));VM_NEXT();
+	VM_OP(push_undefined): vm.push_value(json::undefined);VM_NEXT();
+	VM_OP(op_unary_minus): unar_op(vm, op_unar_minus);VM_NEXT();
+	VM_OP(op_mkrange): bin_op(vm, op_mkrange);VM_NEXT();
+	VM_OP(push_array_1): do_push_array(vm, load_int1());VM_NEXT();
+	VM_OP(push_array_2): do_push_array(vm, load_int2());VM_NEXT();
+	VM_OP(push_array_4): do_push_array(vm, load_int4());VM_NEXT();
+	VM_OP(is_def): vm.push_value(vm.pop_value().defined());VM_NEXT();
+	VM_OP(is_def_1): do_isdef(vm, load_int1());VM_NEXT();
+	VM_OP(is_def_2): do_isdef(vm, load_int2());VM_NEXT();
+	VM_OP(load_local_1): load_local(vm, 0, load_int1());VM_NEXT();
+	VM_OP(load_local_2): load_local(vm, 0, load_int2());VM_NEXT();
+	VM_OP(load_outer): {auto v = load_int2();load_local(vm, v >> 8, v & 0xFF);};VM_NEXT();
+	VM_OP(store_local_1): store_local(vm, load_int1());VM_NEXT();
+	VM_OP(store_local_2): store_local(vm, load_int2());VM_NEXT();
+	VM_OP(pop_local_1): store_local(vm, load_int1());vm.del_value();VM_NEXT();
+	VM_OP(pop_local_2): store_local(vm, load_int2());vm.del_value();VM_NEXT();
+	VM_OP(op_add_const_1): num_op_const<NumAdd>(vm, load_int1(), op_add);VM_NEXT();
+	VM_OP(op_add_const_2): num_op_const<NumAdd>(vm, load_int2(), op_add);VM_NEXT();
+	VM_OP(op_add_const_4): num_op_const<NumAdd>(vm, load_int4(), op_add);VM_NEXT();
+	VM_OP(op_add_const_8): num_op_const<NumAdd>(vm, load_int8(), op_add);VM_NEXT();
+	VM_OP(op_negadd_const_1): negadd_const(vm, load_int1());VM_NEXT();
+	VM_OP(op_negadd_const_2): negadd_const(vm, load_int2());VM_NEXT();
+	VM_OP(op_negadd_const_4): negadd_const(vm, load_int4());VM_NEXT();
+	VM_OP(op_negadd_const_8): negadd_const(vm, load_int8());VM_NEXT();
+	VM_OP(op_mult_const_1): num_op_const<NumMult>(vm, load_int1(), op_mult);VM_NEXT();
+	VM_OP(op_mult_const_2): num_op_const<NumMult>(vm, load_int2(), op_mult);VM_NEXT();
+	VM_OP(op_mult_const_4): num_op_const<NumMult>(vm, load_int4(), op_mult);VM_NEXT();
+	VM_OP(op_mult_const_8): num_op_const<NumMult>(vm, load_int8(), op_mult);VM_NEXT();
+	VM_OP(op_checkbound): bin_op(vm, op_checkbound);VM_NEXT();
+	VM_OP(iter_begin): iter_begin(vm);VM_NEXT();
+	VM_OP(iter_next_1): iter_next(vm, load_int1());VM_NEXT();
+	VM_OP(iter_next_2): iter_next(vm, load_int2());VM_NEXT();
+	VM_OP(loop_enter_1): loop_enter(vm, load_int1());VM_NEXT();
+	VM_OP(loop_enter_2): loop_enter(vm, load_int2());VM_NEXT();
+	VM_OP(loop_leave): loop_leave(vm);VM_NEXT();
+	VM_OP(iter_end): if (iterStack.empty()) invalid_instruction(vm, Cmd::iter_end); else iterStack.pop_back();VM_NEXT();
+	VM_OP(arg_window): vm.define_arg_window(load_int1());VM_NEXT();
+	VM_OP(tail_call): do_tail_call(vm, vm.pop_value(), Value());VM_NEXT();
+	VM_OP(tail_call_1): do_tail_call(vm, pickVar(vm, load_int1()), Value());VM_NEXT();
+	VM_OP(tail_call_2): do_tail_call(vm, pickVar(vm, load_int2()), Value());VM_NEXT();
+	VM_OP(tail_mcall_1): tail_mcall_cached(vm, consts[load_int1()]);VM_NEXT();
+	VM_OP(tail_mcall_2): tail_mcall_cached(vm, consts[load_int2()]);VM_NEXT();
+	VM_OP(switch_table_1): switch_table(vm, load_int1());VM_NEXT();
+	VM_OP(switch_table_2): switch_table(vm, load_int2());VM_NEXT();
@@ -0,0 +1,416 @@
+/*
+ * bytecode.cpp
+ *
+ *  Created on: 18. 10. 2026
+ *      Author: ondra
+ */
+
+#include <cstring>
+#include <imtjson/object.h>
+#include "atoms.h"
+#include "block.h"
+#include "exceptions.h"
+#include "function.h"
+#include "node.h"
+#include "range.h"
+#include "bytecode.h"
+
+namespace mscript {
+
+/*
+ * Format:
+ *
+ * header: "MSCB" <version:byte>
+ * value: <tag:byte> <data>
+ *
+ * numbers are stored as unsigned LEB128 (varuint) or 8 bytes little endian (int, double)
+ */
+
+static constexpr char magic[] = "MSCB";
+static constexpr std::size_t magicLen = 4;
+static constexpr std::uint8_t formatVersion = 4;
+
+enum class Tag: std::uint8_t {
+	undefined,
+	null,
+	false_value,
+	true_value,
+	int_number,		///<8 bytes
+	uint_number,	///<8 bytes
+	double_number,	///<8 bytes
+	string,			///<<len> <bytes>
+	array,			///<<count> <values>
+	object,			///<<count> (<key:len> <bytes> <value>)
+	block,			///<<file> <line> <code> <consts> <locals> <lines>
+	user_function,	///<<expand_last:byte> <identifiers> <block> <closure: undefined or object>
+	range,			///<<begin:8 bytes> <end:8 bytes>
+	switch_table	///<<labels> <count> <targets>
+};
+
+namespace {
+
+class Writer {
+public:
+	std::string out;
+
+	void byte(std::uint8_t b) {out.push_back(static_cast<char>(b));}
+	void tag(Tag t) {byte(static_cast<std::uint8_t>(t));}
+	void varuint(std::uint64_t v) {
+		while (v >= 0x80) {
+			byte(static_cast<std::uint8_t>(v | 0x80));
+			v >>= 7;
+		}
+		byte(static_cast<std::uint8_t>(v));
+	}
+	void u64(std::uint64_t v) {
+		for (int i = 0; i < 8; i++) byte(static_cast<std::uint8_t>(v >> (i*8)));
+	}
+	void str(std::string_view s) {
+		varuint(s.size());
+		out.append(s);
+	}
+	void value(const Value &v);
+	void block(const Block &b);
+	void values(const std::vector<Value> &vals) {
+		varuint(vals.size());
+		for (const Value &v: vals) value(v);
+	}
+};
+
+class Reader {
+public:
+	Reader(std::string_view data):data(data) {}
+
+	std::uint8_t byte() {
+		if (pos >= data.size()) invalid();
+		return static_cast<std::uint8_t>(data[pos++]);
+	}
+	std::uint64_t varuint() {
+		std::uint64_t r = 0;
+		int shift = 0;
+		std::uint8_t b;
+		do {
+			if (shift > 63) invalid();
+			b = byte();
+			r |= static_cast<std::uint64_t>(b & 0x7F) << shift;
+			shift += 7;
+		} while (b & 0x80);
+		return r;
+	}
+	std::uint64_t u64() {
+		std::uint64_t r = 0;
+		for (int i = 0; i < 8; i++) r |= static_cast<std::uint64_t>(byte()) << (i*8);
+		return r;
+	}
+	std::string_view bytes(std::uint64_t n) {
+		if (n > data.size() - pos) invalid();
+		auto r = data.substr(pos, n);
+		pos += n;
+		return r;
+	}
+	std::string_view str() {
+		return bytes(varuint());
+	}
+	std::size_t count() {
+		auto n = varuint();
+		//each item has at least one byte, so it protects against large allocations
+		if (n > data.size() - pos) invalid();
+		return static_cast<std::size_t>(n);
+	}
+	std::vector<Value> values() {
+		std::vector<Value> out;
+		auto n = count();
+		out.reserve(n);
+		for (std::size_t i = 0; i < n; i++) out.push_back(value());
+		return out;
+	}
+	///Reads names of variables, they are interned (see Atoms)
+	std::vector<Value> names() {
+		std::vector<Value> out = values();
+		for (Value &v: out) {
+			if (v.type() != json::string) invalid();
+			v = Atoms::intern(v.getString());
+		}
+		return out;
+	}
+	Value value() {
+		//values are read recursively, so deeply nested input could exhaust the stack
+		if (++depth > maxDepth) invalid();
+		Value r = readValue();
+		--depth;
+		return r;
+	}
+	Block block();
+	///Verifies code of the block, so it cannot access memory outside of the block
+	static void verify(const Block &b);
+
+	bool eof() const {return pos == data.size();}
+
+	[[noreturn]] static void invalid() {
+		throw BuildError("Invalid format of compiled block");
+	}
+
+protected:
+	///max nesting of values (containers, blocks in constants, functions)
+	static constexpr unsigned int maxDepth = 256;
+
+	std::string_view data;
+	std::size_t pos = 0;
+	unsigned int depth = 0;
+
+	Value readValue();
+};
+
+void Writer::value(const Value &v) {
+	if (isBlock(v)) {
+		tag(Tag::block);
+		block(getBlockFromValue(v));
+		return;
+	}
+	if (isFunction(v)) {
+		const UserFn *ufn = dynamic_cast<const UserFn *>(&getFunction(v));
+		if (!ufn) throw BuildError("Compiled block contains native function, which cannot be serialized");
+		tag(Tag::user_function);
+		byte(ufn->is_expand_all()?1:0);
+		values(ufn->getIdentifiers());
+		value(ufn->getCode());
+		if (v.type() == json::object) {
+			//function with closure (see repackFunction)
+			tag(Tag::object);
+			varuint(v.size());
+			for (Value x: v) {
+				str(x.getKey());
+				value(x);
+			}
+		} else {
+			tag(Tag::undefined);
+		}
+		return;
+	}
+	if (isSwitchTable(v)) {
+		const SwitchTable &tbl = getSwitchTableFromValue(v);
+		tag(Tag::switch_table);
+		values(tbl.getLabels());
+		varuint(tbl.getTargets().size());
+		for (auto t: tbl.getTargets()) varuint(t);
+		return;
+	}
+	if (isNativeType(v)) throw BuildError("Compiled block contains native value, which cannot be serialized");
+	switch (v.type()) {
+		case json::undefined: tag(Tag::undefined);break;
+		case json::null: tag(Tag::null);break;
+		case json::boolean: tag(v.getBool()?Tag::true_value:Tag::false_value);break;
+		case json::number:
+			if (v.flags() & json::numberUnsignedInteger) {
+				tag(Tag::uint_number);
+				u64(v.getUIntLong());
+			} else if (v.flags() & json::numberInteger) {
+				tag(Tag::int_number);
+				u64(static_cast<std::uint64_t>(v.getIntLong()));
+			} else {
+				double d = v.getNumber();
+				std::uint64_t u;
+				std::memcpy(&u, &d, sizeof(u));
+				tag(Tag::double_number);
+				u64(u);
+			}
+			break;
+		case json::string:
+			tag(Tag::string);
+			str(v.getString());
+			break;
+		case json::array: {
+			auto rng = dynamic_cast<const RangeValue *>(v.getHandle()->unproxy());
+			if (rng) {
+				tag(Tag::range);
+				u64(static_cast<std::uint64_t>(rng->getBegin()));
+				u64(static_cast<std::uint64_t>(rng->getBegin() + rng->getDirection() * static_cast<json::Int>(rng->size()-1)));
+			} else {
+				tag(Tag::array);
+				varuint(v.size());
+				for (Value x: v) value(x);
+			}
+		}break;
+		case json::object:
+			tag(Tag::object);
+			varuint(v.size());
+			for (Value x: v) {
+				str(x.getKey());
+				value(x);
+			}
+			break;
+	}
+}
+
+void Writer::block(const Block &b) {
+	str(b.location.file);
+	varuint(b.location.line);
+	varuint(b.code.size());
+	out.append(reinterpret_cast<const char *>(b.code.data()), b.code.size());
+	values(b.consts);
+	values(b.locals);
+	varuint(b.lines.size());
+	for (const auto &l: b.lines) {
+		varuint(l.first);
+		varuint(l.second);
+	}
+}
+
+Value Reader::readValue() {
+	Tag t = static_cast<Tag>(byte());
+	switch (t) {
+		case Tag::undefined: return json::undefined;
+		case Tag::null: return nullptr;
+		case Tag::false_value: return false;
+		case Tag::true_value: return true;
+		case Tag::int_number: return Value(static_cast<std::int64_t>(u64()));
+		case Tag::uint_number: return Value(static_cast<std::uint64_t>(u64()));
+		case Tag::double_number: {
+			std::uint64_t u = u64();
+			double d;
+			std::memcpy(&d, &u, sizeof(d));
+			return Value(d);
+		}
+		case Tag::string: return Value(str());
+		case Tag::array: {
+			auto items = values();
+			return Value(json::array, items.begin(), items.end(), [](const Value &x){return x;});
+		}
+		case Tag::object: {
+			json::Object obj;
+			auto n = count();
+			for (std::size_t i = 0; i < n; i++) {
+				auto key = str();
+				obj.set(key, value());
+			}
+			return obj;
+		}
+		case Tag::block:
+			return packToValue(block());
+		case Tag::user_function: {
+			bool expand_last = byte() != 0;
+			auto identifiers = names();
+			Value code = value();
+			if (!isBlock(code)) invalid();
+			Value closure = value();
+			const Block &bk = getBlockFromValue(code);
+			Value content = closure.type() == json::object?closure:Value({"@FN",bk.location.file, bk.location.line});
+			auto ptr = std::make_shared<UserFn>(std::move(code), std::move(identifiers), expand_last);
+			return packToValue(std::shared_ptr<AbstractFunction>(std::move(ptr)), content);
+		}
+		case Tag::range: {
+			auto b = static_cast<json::Int>(u64());
+			auto e = static_cast<json::Int>(u64());
+			return newRange(b, e);
+		}
+		case Tag::switch_table: {
+			auto labels = values();
+			auto n = count();
+			if (n != labels.size() || !SwitchTable::isSuitable(labels)) invalid();
+			std::vector<std::size_t> targets;
+			targets.reserve(n);
+			for (std::size_t i = 0; i < n; i++) targets.push_back(static_cast<std::size_t>(varuint()));
+			return packToValue(SwitchTable(std::move(labels), std::move(targets)));
+		}
+		default:
+			invalid();
+	}
+}
+
+Block Reader::block() {
+	Block b;
+	b.location.file = std::string(str());
+	b.location.line = varuint();
+	auto code = bytes(varuint());
+	b.code.assign(code.begin(), code.end());
+	b.consts = values();
+	b.locals = names();
+	auto n = count();
+	b.lines.reserve(n);
+	for (std::size_t i = 0; i < n; i++) {
+		auto pos = varuint();
+		auto line = varuint();
+		b.lines.push_back({pos, line});
+	}
+	verify(b);
+	b.hashNames();
+	return b;
+}
+
+void Reader::verify(const Block &b) {
+	//verify instructions, so operands cannot be read behind the code
+	//(unknown instructions are reported during execution)
+	const auto sz = b.code.size();
+	std::vector<bool> boundary(sz+1, false);
+	std::size_t p = 0;
+	while (p < sz) {
+		boundary[p] = true;
+		p += 1 + getCmdOperandSize(static_cast<Cmd>(b.code[p]));
+	}
+	if (p != sz) invalid();
+	boundary[sz] = true;
+	//verify operands - indexes of consts and slots of locals must exist,
+	//jumps must land at beginning of an instruction
+	p = 0;
+	while (p < sz) {
+		Cmd cmd = static_cast<Cmd>(b.code[p]);
+		const CmdOperand op = getCmdOperand(cmd);
+		p += 1 + op.size;
+		if (op.kind == OperandKind::none || op.kind == OperandKind::immediate) continue;
+		//all indexes are stored in 1 or 2 bytes
+		if (op.size != 1 && op.size != 2) invalid();
+		//operand is signed (same as load_int1, load_int2)
+		std::intptr_t v = op.size == 1?static_cast<std::int8_t>(b.code[p-1])
+				:static_cast<std::int8_t>(b.code[p-2]) * 256 + b.code[p-1];
+		switch (op.kind) {
+			case OperandKind::constant:
+				if (v < 0 || static_cast<std::size_t>(v) >= b.consts.size()) invalid();
+				break;
+			case OperandKind::local:
+				if (v < 0 || static_cast<std::size_t>(v) >= b.locals.size()) invalid();
+				break;
+			case OperandKind::outer:
+				if (v < 0 || static_cast<std::size_t>(v & 0xFF) >= b.locals.size()) invalid();
+				break;
+			default: {
+				//relative to the end of the instruction
+				std::intptr_t t = static_cast<std::intptr_t>(p) + v;
+				if (t < 0 || static_cast<std::size_t>(t) > sz || !boundary[t]) invalid();
+				break;
+			}
+		}
+		if (cmd == Cmd::switch_table_1 || cmd == Cmd::switch_table_2) {
+			//the table must exist and it must not jump outside of the code
+			if (!isSwitchTable(b.consts[v])) invalid();
+			for (auto t: getSwitchTableFromValue(b.consts[v]).getTargets()) {
+				if (t > sz || !boundary[t]) invalid();
+			}
+		}
+	}
+}
+
+}
+
+std::string saveBlock(const Value &block) {
+	if (!isBlock(block)) throw BuildError("Value is not a compiled block");
+	Writer wr;
+	wr.out.append(magic, magicLen);
+	wr.byte(formatVersion);
+	wr.value(block);
+	return std::move(wr.out);
+}
+
+bool isSerializedBlock(std::string_view data) {
+	return data.size() > magicLen && data.substr(0, magicLen) == std::string_view(magic, magicLen)
+			&& static_cast<std::uint8_t>(data[magicLen]) == formatVersion;
+}
+
+Value loadBlock(std::string_view data) {
+	if (!isSerializedBlock(data)) Reader::invalid();
+	Reader rd(data.substr(magicLen+1));
+	Value r = rd.value();
+	if (!isBlock(r) || !rd.eof()) Reader::invalid();
+	return r;
+}
+
+}
@@ -0,0 +1,46 @@
+/*
+ * bytecode.h
+ *
+ *  Created on: 18. 10. 2026
+ *      Author: ondra
+ */
+
+#ifndef SRC_MSCRIPT_BYTECODE_H_
+#define SRC_MSCRIPT_BYTECODE_H_
+
+#include <string>
+#include <string_view>
+#include "value.h"
+
+namespace mscript {
+
+///Serializes compiled block to binary format
+/**
+ * Stores the block including its constants, code, local variables, line map, location,
+ * and nested blocks and user functions. Result can be stored to a file and loaded by
+ * loadBlock without need to compile the script again.
+ *
+ * @param block compiled block (see Compiler)
+ * @return binary data
+ * @exception BuildError block contains a value which cannot be serialized (native values)
+ */
+std::string saveBlock(const Value &block);
+
+///Loads compiled block from binary format
+/**
+ * @param data binary data created by saveBlock. The data are accessed directly,
+ * so they can be mapped to the memory from a file. They are not referenced after
+ * the function returns
+ * @return compiled block
+ * @exception BuildError invalid or corrupted data
+ */
+Value loadBlock(std::string_view data);
+
+///Determines, whether data contains serialized block (checks header)
+bool isSerializedBlock(std::string_view data);
+
+}
+
+
+
+#endif /* SRC_MSCRIPT_BYTECODE_H_ */
@@ -12,6 +12,13 @@
 
 using json::Array;
 
+///Budget of instructions to evaluate constant expressions (case labels, constexpr)
+/**
+ * It doesn't depend on compileTimeBudget, which is reduced when evaluation of a statement
+ * exhausts it. Constant expressions are required, they cannot fall back to runtime
+ */
+static constexpr std::size_t defaultConstBudget = 1000000;
+
 namespace mscript {
 
 
@@ -23,12 +30,35 @@ PNode Compiler::compile(std::vector<Element> &&code, const CodeLocation &loc) {
 	curLine = 0;
 	lastLine = 0;
 	curSymbol = 0;
+	nestLevel = 0;
+	tokenizer = nullptr;
 	return compileBlockContent();
 }
 
+PNode Compiler::compile(Tokenizer &tokenizer, const CodeLocation &loc) {
+	this->code.clear();
+	this->loc = loc;
+	curLine = 0;
+	lastLine = 0;
+	curSymbol = 0;
+	nestLevel = 0;
+	this->tokenizer = &tokenizer;
+	PNode res = compileBlockContent();
+	this->tokenizer = nullptr;
+	return res;
+}
+
 const Element& Compiler::next() {
-	if (curSymbol >= code.size()) return eof;
-	else return code[curSymbol];
+	while (curSymbol >= code.size()) {
+		if (!tokenizer) return eof;
+		Element el = tokenizer->readNext();
+		if (el.symbol == Symbol::eof) {
+			tokenizer = nullptr;
+			return eof;
+		}
+		code.push_back(std::move(el));
+	}
+	return code[curSymbol];
 }
 
 void Compiler::commit() {
@@ -81,12 +111,13 @@ PNode Compiler::handleValueSuffixes(PNode expr) {
 		if (s.symbol == Symbol::identifier) {
 			commit();
 			PNode vn = std::make_unique<ValueNode>(s.data);
+			Value scope = memberFoldScope(expr);
 			auto t = next();
 			if (t.symbol == Symbol::s_left_bracket) {
 				commit();
-				return handleValueSuffixes(std::make_unique<MethodCallNode>(std::move(expr), s.data, compileValueList()));
+				return handleValueSuffixes(foldConstants(std::make_unique<MethodCallNode>(std::move(expr), s.data, compileValueList()), scope));
 			} else {
-				return handleValueSuffixes(std::make_unique<DerefernceDotNode>(std::move(expr), s.data));
+				return handleValueSuffixes(foldConstants(std::make_unique<DerefernceDotNode>(std::move(expr), s.data), scope));
 			}
 		}
 		throw compileError("Expected identifier after '.' ");
@@ -181,11 +212,11 @@ PNode Compiler::compileValue() {
 		return compileIfDefExpression();
 	case Symbol::s_exclamation:
 		commit();
-		out = std::make_unique<UnaryOperation>(compileValue(),Cmd::op_bool_not);
+		out = foldConstants(std::make_unique<UnaryOperation>(compileValue(),Cmd::op_bool_not), globalScope);
 		break;
 	case Symbol::kw_not:
 		commit();
-		out = std::make_unique<UnaryOperation>(compileValue(),Cmd::op_bool_not);
+		out = foldConstants(std::make_unique<UnaryOperation>(compileValue(),Cmd::op_bool_not), globalScope);
 		break;
 	case Symbol::s_minus:
 		commit();
@@ -194,7 +225,7 @@ PNode Compiler::compileValue() {
 			auto d = static_cast<const NumberNode *>(c.get());
 			out = std::make_unique<NumberNode>(-(d->getValue().getNumber()));
 		} else {
-			out = std::make_unique<UnaryOperation>(compileValue(),Cmd::op_unary_minus);
+			out = foldConstants(std::make_unique<UnaryOperation>(compileValue(),Cmd::op_unary_minus), globalScope);
 		}
 		break;
 	case Symbol::s_plus:
@@ -247,10 +278,10 @@ PNode Compiler::parseIfElse() {
 		} else {
 			blk2 = compileBlockOrExpression();
 		}
-		return std::make_unique<IfElseNode>(std::move(cond), std::move(blk1), std::move(blk2));
+		return foldConstants(std::make_unique<IfElseNode>(std::move(cond), std::move(blk1), std::move(blk2)), globalScope);
 	} else {
 		if (eat) {curSymbol--;curLine--;} //only else is allowed on next line, otherwise go one symbol back
-		return std::make_unique<IfElseNode>(std::move(cond), std::move(blk1), std::move(std::make_unique<DirectCmdNode>(Cmd::push_null)));
+		return foldConstants(std::make_unique<IfElseNode>(std::move(cond), std::move(blk1), std::move(std::make_unique<DirectCmdNode>(Cmd::push_null))), globalScope);
 	}
 
 }
@@ -315,6 +346,7 @@ PNode Compiler::compileDefineFunction(PNode expr) {
 	bool expandLast = false;
 	if (in) {
 		identifiers.push_back(in->getName().getString());
+		shadow(in->getName());
 	} else {
 		ValueListNode &pp = dynamic_cast<ValueListNode &>(*expr);
 		const auto &items = pp.getItems();
@@ -324,10 +356,13 @@ PNode Compiler::compileDefineFunction(PNode expr) {
 			if (expandLast) throw compileError("Symbol ... (three dots) is allowed only for the last argument");
 			expandLast = k.expandArray;
 			identifiers.push_back(x->getName());
+			shadow(x->getName());
 		}
 	}
 	commit();
+	++nestLevel;
 	PNode blk=compileBlockOrExpression();
+	--nestLevel;
 	Value fn = defineUserFunction(std::move(identifiers), expandLast,std::move(blk), {loc.file, loc.line+curLine});
 	return std::make_unique<ValueNode>(fn);
 
@@ -375,23 +410,30 @@ PNode Compiler::compileBlockContent() {
 		auto l = curLine;
 		if (s.symbol != Symbol::separator) {
 			PNode cmd = compileCommand();
-			if (compilerExecTm) {
+			if (compileTimeBudget) {
 				Value bk = packToValue(buildCode(cmd, loc, true));
 				result.reset();
 				bool err = false;
+				auto startTm = std::chrono::steady_clock::now();
+				auto startSteps = vm.getStepCount();
 				vm.push_task(std::make_unique<CompileTimeContent>(err));
 				vm.push_task(std::make_unique<BlockExecution>(bk));
-				auto execTm = std::chrono::system_clock::now()+std::chrono::milliseconds(compilerExecTm);
-				while (vm.run()) {
-					if (std::chrono::system_clock::now()>execTm) {
-						err = true;
-						compilerExecTm>>=1;
-						break;
-					}
+				if (vm.run(compileTimeBudget) == VirtualMachine::RunState::suspended) {
+					//unwind to CompileTimeContent, which restores state of the VM
+					do {
+						vm.raise(std::make_exception_ptr(ExecutionLimitReached(LimitType::instructions)));
+					} while (vm.run(compileTimeBudget) == VirtualMachine::RunState::suspended);
+					ctStats.exhausted++;
+					compileTimeBudget>>=1;
 				}
+				ctStats.evaluated++;
+				ctStats.instructions += vm.getStepCount() - startSteps;
+				ctStats.duration += std::chrono::steady_clock::now() - startTm;
 				if (err) {
 					nodes.push_back(std::make_unique<InputLineMapNode>(l,std::move(cmd)));
 				} else {
+					ctStats.folded++;
+					ctStats.foldedLines.push_back(l);
 					Value variables = vm.scope_to_object();
 					bool has_res = true;
 					for (Value x: variables) {
@@ -425,7 +467,9 @@ PNode Compiler::compileBlockContent() {
 
 PNode Compiler::compileBlock() {
 	sync(Symbol::s_left_brace);
+	++nestLevel;
 	PNode ret = compileBlockContent();
+	--nestLevel;
 	sync(Symbol::s_right_brace);
 	return ret;
 }
@@ -472,6 +516,7 @@ PNode Compiler::tryCompileAssgn() {
 	if (s.symbol==Symbol::identifier) {
 		commit();
 		if (next().symbol==Symbol::s_equal || next().symbol==Symbol::s_qequal) {
+			shadow(s.data);
 			return std::make_unique<SimpleAssignNode>(s.data);
 		}else{
 			return nullptr;
@@ -501,6 +546,8 @@ PNode Compiler::tryCompileAssgn() {
         if (s.symbol ==Symbol::s_right_bracket){
         	commit();
     		if (next().symbol==Symbol::s_equal) {
+    			for (const Value &x: idents) shadow(x);
+    			shadow(expand);
     			return std::make_unique<PackAssignNode>(std::move(idents), expand);
     		}else{
     			return nullptr;
@@ -534,7 +581,7 @@ PNode Compiler::compileTernal() {
 			eatSeparators();
 			PNode nd3 = compileExpression();
 			eatSeparators();
-			return std::make_unique<IfElseNode>(std::move(nd1),std::move(nd2),std::move(nd3));
+			return foldConstants(std::make_unique<IfElseNode>(std::move(nd1),std::move(nd2),std::move(nd3)), globalScope);
 		} else{
 			throw compileError("Expected ':' ");
 		}
@@ -547,7 +594,7 @@ PNode Compiler::compileOr() {
 	PNode nd = compileAnd();
 	if (next().symbol == Symbol::kw_or) {
 		commit();
-		return std::make_unique<BooleanAndOrNode>(std::move(nd), compileOr(), false);
+		return foldConstants(std::make_unique<BooleanAndOrNode>(std::move(nd), compileOr(), false), globalScope);
 	} else {
 		return nd;
 	}
@@ -557,7 +604,7 @@ PNode Compiler::compileAnd() {
 	PNode nd = compileCompare();
 	if (next().symbol == Symbol::kw_and) {
 		commit();
-		return std::make_unique<BooleanAndOrNode>(std::move(nd), compileAnd(), true);
+		return foldConstants(std::make_unique<BooleanAndOrNode>(std::move(nd), compileAnd(), true), globalScope);
 	}else if (next().symbol == Symbol::s_dblq) {
 		commit();
 		return std::make_unique<IsDefDoubleQuoteNode>(std::move(nd), compileAnd());
@@ -580,7 +627,7 @@ PNode Compiler::compileCompare() {
 	default: return nd;
 	}
 	commit();
-	return std::make_unique<BinaryOperation>(std::move(nd), compileCompare(), cmd);
+	return foldConstants(std::make_unique<BinaryOperation>(std::move(nd), compileCompare(), cmd), globalScope);
 }
 
 PNode Compiler::compileAddSub() {
@@ -589,10 +636,10 @@ PNode Compiler::compileAddSub() {
 	switch(next().symbol) {
 	case Symbol::s_plus:
 		commit();
-		return std::make_unique<OpAddNode>(std::move(nd), compileAddSub());
+		return foldConstants(std::make_unique<OpAddNode>(std::move(nd), compileAddSub()), globalScope);
 	case Symbol::s_minus:
 		commit();
-		return std::make_unique<OpSubNode>(std::move(nd), compileAddSub());
+		return foldConstants(std::make_unique<OpSubNode>(std::move(nd), compileAddSub()), globalScope);
 	default: return nd;
 	}
 }
@@ -603,13 +650,13 @@ PNode Compiler::compileMultDiv() {
 	switch(next().symbol) {
 	case Symbol::s_star:
 		commit();
-		return std::make_unique<OpMultNode>(std::move(nd), compileMultDiv());
+		return foldConstants(std::make_unique<OpMultNode>(std::move(nd), compileMultDiv()), globalScope);
 	case Symbol::s_slash: cmd = Cmd::op_div; break;
 	case Symbol::s_percent: cmd = Cmd::op_mod; break;
 	default: return nd;
 	}
 	commit();
-	return std::make_unique<BinaryOperation>(std::move(nd), compileMultDiv(), cmd);
+	return foldConstants(std::make_unique<BinaryOperation>(std::move(nd), compileMultDiv(), cmd), globalScope);
 }
 
 PNode Compiler::compilePower() {
@@ -620,7 +667,7 @@ PNode Compiler::compilePower() {
 	default: return nd;
 	}
 	commit();
-	return std::make_unique<BinaryOperation>(std::move(nd), compilePower(), cmd);
+	return foldConstants(std::make_unique<BinaryOperation>(std::move(nd), compilePower(), cmd), globalScope);
 }
 
 PNode Compiler::compileArray() {
@@ -666,6 +713,7 @@ PNode Compiler::compileFor() {
 			}
 			Value ident = next().data;
 			commit();
+			shadow(ident);
 			switch(next().symbol) {
 			case Symbol::s_doublecolon:
 				commit();
@@ -698,11 +746,24 @@ PNode Compiler::compileFor() {
 }
 
 PNode Compiler::compileWhile() {
+	//condition is evaluated repeatedly
+	++nestLevel;
 	PNode cond = compileExpression();
+	--nestLevel;
 	sync(Symbol::s_right_bracket);
 	return std::make_unique<WhileLoopNode>(std::move(cond), compileBlock());
 }
 
+void Compiler::shadow(const Value &name) {
+	if (name.type() == json::string) shadowed.insert(name);
+}
+
+Value Compiler::memberFoldScope(const PNode &expr) const {
+	auto ident = dynamic_cast<const Identifier *>(expr.get());
+	if (!ident || !foldMembers || nestLevel || shadowed.count(ident->getName())) return Value();
+	return globalScope;
+}
+
 PNode Compiler::compileBlockOrExpression() {
 	auto s = next();
 	switch(s.symbol) {
@@ -775,7 +836,7 @@ PNode Compiler::compileSwitch() {
 		if (defaultNode == nullptr) return selector;
 		return defaultNode;
 	} else {
-		return std::make_unique<SwitchCaseNode>(std::move(selector),SwitchCaseNode::Labels(ctbl.begin(), ctbl.end()), std::move(ndtbl), std::move(defaultNode));
+		return foldConstants(std::make_unique<SwitchCaseNode>(std::move(selector),SwitchCaseNode::Labels(ctbl.begin(), ctbl.end()), std::move(ndtbl), std::move(defaultNode)), globalScope);
 	}
 }
 
@@ -794,7 +855,7 @@ Value Compiler::expressionToConst() {
 	PNode nd = compileBlockOrExpression();
 	Value code = packToValue(buildCode(nd, {loc.file, loc.line+curLine}));
 	VirtualMachine vm;
-	vm.setMaxExecutionTime(std::chrono::seconds(5));
+	vm.setFuel(defaultConstBudget);
 	return vm.exec(std::make_unique<BlockExecution>(code));
 }
 
@@ -892,9 +953,13 @@ PNode Compiler::compileNumber() {
 }
 
 Value Compiler::compileString(const CodeLocation &loc, const std::string_view &str) {
-	auto iter = str.begin();
-	auto e = str.end();
-	return compileText(loc, [&](){return iter == e?-1:static_cast<int>(*iter++);});
+	Tokenizer tk(str);
+	return packToValue(buildCode(compile(tk, loc), loc));
+}
+
+Value Compiler::compileFile(const CodeLocation &loc, const std::string &fname) {
+	SourceFile f(fname);
+	return compileString(loc, f.getText());
 }
 
 PNode Compiler::compileCast(PNode &&expr, PNode &&baseObj) {
@@ -8,7 +8,9 @@
 #ifndef SRC_MSCRIPT_COMPILER_H_
 #define SRC_MSCRIPT_COMPILER_H_
 
+#include <unordered_set>
 #include "parser.h"
+#include "tokenizer.h"
 #include "node.h"
 #include "vm.h"
 
@@ -18,7 +20,31 @@ namespace mscript {
 class Compiler {
 public:
 
-	Compiler(Value globalScope, std::size_t compilerExecTm=10000):globalScope(globalScope),compilerExecTm(compilerExecTm) {}
+	///Statistics of compile time evaluation
+	struct CompileTimeStats {
+		///count of statements evaluated during compilation
+		std::size_t evaluated = 0;
+		///count of statements replaced by their result
+		std::size_t folded = 0;
+		///count of statements, which exhausted the budget
+		std::size_t exhausted = 0;
+		///count of instructions executed during compile time evaluation
+		std::uint64_t instructions = 0;
+		///time spent by compile time evaluation (for profiling, it doesn't affect the result)
+		std::chrono::steady_clock::duration duration = {};
+		///lines of folded statements (relative to the compiled code)
+		std::vector<std::size_t> foldedLines;
+	};
+
+	///Construct compiler
+	/**
+	 * @param globalScope global scope
+	 * @param compileTimeBudget max count of instructions executed when a statement is evaluated
+	 * during compilation. If the budget is exhausted, the statement is left to the runtime and the
+	 * budget is halved for next statements. Set 0 to disable compile time evaluation
+	 */
+	Compiler(Value globalScope, std::size_t compileTimeBudget=1000000)
+		:globalScope(globalScope),compileTimeBudget(compileTimeBudget),foldMembers(compileTimeBudget != 0) {}
 
 	///Compile code
 	/**
@@ -34,6 +60,14 @@ public:
 	 * @return Value which contains block which can be executed using VirtualMachine
 	 */
 	Value compileString(const CodeLocation &loc, const std::string_view &str);
+	///Compile file
+	/**
+	 * The file is mapped to the memory and tokenized directly (see SourceFile)
+	 * @param loc code location
+	 * @param fname path to the file
+	 * @return Value which contains block which can be executed using VirtualMachine
+	 */
+	Value compileFile(const CodeLocation &loc, const std::string &fname);
 
 	///Parses include file
 	/**
@@ -45,18 +79,33 @@ public:
 	 */
 	virtual bool onInclude(std::string_view name, CodeLocation &loc, std::vector<Element> &code) {return false;}
 
+	///Retrieves statistics of compile time evaluation (accumulated for all compilations)
+	const CompileTimeStats &getCompileTimeStats() const {return ctStats;}
+
 
 protected:
 	PNode compile(std::vector<Element> &&code, const CodeLocation &loc);
+	///Compile code, elements are read from the tokenizer on demand
+	PNode compile(Tokenizer &tokenizer, const CodeLocation &loc);
 
 
+	///Elements read so far (kept to allow to go back)
 	std::vector<Element> code;
+	///Source of further elements, nullptr if all elements are in the code
+	Tokenizer *tokenizer = nullptr;
 	Value globalScope;
-	std::size_t compilerExecTm;
+	std::size_t compileTimeBudget;
+	CompileTimeStats ctStats;
 	//BlockBld &bld;
 	CodeLocation loc;
 	int curLine = 0;
 	int lastLine = 0;
+	///Members of global objects (Math.PI) can be folded (same assumption as compile time evaluation)
+	bool foldMembers;
+	///Level of code, which is not executed once in order of the text (functions, loops, blocks)
+	int nestLevel = 0;
+	///Names which has been assigned or declared in the compiled code, they can shadow global objects
+	std::unordered_set<Value> shadowed;
 	std::size_t curSymbol = 0;
 	Element eof{Symbol::eof};
 
@@ -76,6 +125,16 @@ protected:
 	PNode compileDefineFunction(PNode expr);
 	PNode compileBlockContent();
 	PNode compileBlock();
+	///Records name, which can shadow a global object
+	void shadow(const Value &name);
+	///Retrieves global scope for folding member of the expression (see INode::fold)
+	/**
+	 * @param expr left side of member access
+	 * @return global scope, or undefined, when the member cannot be folded. It is folded
+	 * only when the expression is an identifier, which cannot be shadowed - in top level
+	 * code, which is executed once, when the identifier hasn't been assigned yet
+	 */
+	Value memberFoldScope(const PNode &expr) const;
 	PNode compileCommand();
 	PNode compileExpression();
 	PNode compileTernal();
@@ -64,6 +64,11 @@ void Block::disassemble_iter(std::vector<std::uint8_t>::const_iterator &iter, co
 		if (txt[p+1] == 'F') {
 			auto f = loadFloat();
 			txt = txt.substr(0,p)+std::to_string(f);
+		} else if (v == Cmd::load_outer) {
+			auto num = loadNum(txt[p+1]);
+			auto slot = static_cast<std::size_t>(num & 0xFF);
+			std::string name = slot < locals.size()?std::string(locals[slot].getString()):std::string("?");
+			txt = txt.substr(0,p)+std::to_string(num >> 8)+":"+std::to_string(slot)+":"+name+txt.substr(p+2);
 		} else {
 			auto num = loadNum(txt[p+1]);
 			txt = txt.substr(0,p)+std::to_string(num)+txt.substr(p+2);
@@ -81,6 +86,13 @@ void Block::disassemble_iter(std::vector<std::uint8_t>::const_iterator &iter, co
 				auto num = loadNum(txt[p+1]);
 				num += std::distance(code.begin(), iter);
 				txt = txt.substr(0,p)+std::to_string(num)+txt.substr(p+2);
+			} else {
+				p = txt.find('#');
+				if (p != txt.npos) {
+					auto num = loadNum(txt[p+1]);
+					std::string name = static_cast<std::size_t>(num) < locals.size()?std::string(locals[num].getString()):std::string("?");
+					txt = txt.substr(0,p)+std::to_string(num)+":"+name+txt.substr(p+2);
+				}
 			}
 
 		}
@@ -61,7 +61,9 @@ void MaxExecutionTimeReached::what(std::string &out) const {
 json::NamedEnum<LimitType> strLimitType({
 	{LimitType::calcStack, "calc.stack"},
 	{LimitType::scopeStack, "recursion count - max scope count"},
-	{LimitType::taskStack, "recursion count - max task count"}
+	{LimitType::taskStack, "recursion count - max task count"},
+	{LimitType::instructions, "instruction count"},
+	{LimitType::memory, "memory"}
 });
 
 ExecutionLimitReached::ExecutionLimitReached(LimitType t):t(t) {
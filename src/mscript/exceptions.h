@@ -65,6 +65,8 @@ enum class LimitType {
 	calcStack,
 	taskStack,
 	scopeStack,
+	instructions,
+	memory,
 };
 
 extern json::NamedEnum<LimitType> strLimitType;
@@ -0,0 +1,141 @@
+/*
+ * fold.cpp
+ *
+ *  Created on: 18. 10. 2026
+ *      Author: ondra
+ */
+
+#include "node.h"
+
+namespace mscript {
+
+///Only simple values are folded (containers, functions and native values are left to the runtime)
+static bool isSimpleConstant(const Value &v) {
+	switch (v.type()) {
+		case json::undefined:
+		case json::null:
+		case json::boolean:
+		case json::number:
+		case json::string: return !isNativeType(v);
+		default: return false;
+	}
+}
+
+bool getConstant(const PNode &nd, Value &out) {
+	if (auto n = dynamic_cast<const NumberNode *>(nd.get())) {
+		out = n->getValue();
+		return true;
+	}
+	if (auto n = dynamic_cast<const ValueNode *>(nd.get())) {
+		if (dynamic_cast<const BlockValueNode *>(n)) return false;
+		const Value &v = n->getValue();
+		if ((v.flags() & paramPackValue) || !isSimpleConstant(v)) return false;
+		out = v;
+		return true;
+	}
+	if (auto n = dynamic_cast<const DirectCmdNode *>(nd.get())) {
+		switch (n->getCmd()) {
+			case Cmd::push_true: out = true;return true;
+			case Cmd::push_false: out = false;return true;
+			case Cmd::push_null: out = nullptr;return true;
+			case Cmd::push_undefined: out = json::undefined;return true;
+			case Cmd::push_zero_int: out = 0;return true;
+			default: return false;
+		}
+	}
+	return false;
+}
+
+PNode constantNode(Value v) {
+	switch (v.type()) {
+		case json::number: return std::make_unique<NumberNode>(v);
+		case json::boolean: return std::make_unique<BooleanNode>(v.getBool());
+		case json::null: return std::make_unique<NullNode>();
+		case json::undefined: return std::make_unique<UndefinedNode>();
+		default: return std::make_unique<ValueNode>(v);
+	}
+}
+
+PNode foldConstants(PNode &&nd, const Value &globalScope) {
+	PNode r = nd->fold(globalScope);
+	if (r) return r;
+	return std::move(nd);
+}
+
+PNode BinaryOperation::fold(const Value &) {
+	Value a, b, r;
+	if (getConstant(left, a) && getConstant(right, b)
+			&& BlockExecution::eval_const(instruction, a, b, r) && isSimpleConstant(r)) {
+		return constantNode(r);
+	}
+	return nullptr;
+}
+
+PNode UnaryOperation::fold(const Value &) {
+	Value a, r;
+	if (getConstant(item, a) && BlockExecution::eval_const(instruction, a, r) && isSimpleConstant(r)) {
+		return constantNode(r);
+	}
+	return nullptr;
+}
+
+PNode IfElseNode::fold(const Value &) {
+	Value c;
+	if (!getConstant(cond, c)) return nullptr;
+	return std::move(c.getBool()?nd_then:nd_else);
+}
+
+PNode BooleanAndOrNode::fold(const Value &) {
+	Value c;
+	if (!getConstant(left, c)) return nullptr;
+	//result is the left value, when it decides, otherwise the right value
+	return std::move(c.getBool() == and_node?right:left);
+}
+
+PNode SwitchCaseNode::fold(const Value &) {
+	Value c;
+	if (!getConstant(selector, c)) return nullptr;
+	for (const auto &l: labels) {
+		if (l.first == c) return std::move(nodes[l.second]);
+	}
+	//without default, the selector is the result
+	if (defNode == nullptr) return std::move(selector);
+	return std::move(defNode);
+}
+
+///Resolves member of a global object (Math.PI, Math.sin). Returns undefined, if not found
+/**
+ * The compiler passes undefined global scope, when the identifier can be shadowed
+ * (see Compiler::memberFoldScope)
+ */
+static Value globalMember(const Value &globalScope, const PNode &left, const Value &identifier) {
+	auto ident = dynamic_cast<const Identifier *>(left.get());
+	if (!ident) return json::undefined;
+	Value obj = globalScope[ident->getName().getString()];
+	if (obj.type() != json::object) return json::undefined;
+	return obj[identifier.getString()];
+}
+
+PNode DerefernceDotNode::fold(const Value &globalScope) {
+	Value v = globalMember(globalScope, left, identifier);
+	if (v.type() != json::number) return nullptr;
+	return constantNode(v);
+}
+
+PNode MethodCallNode::fold(const Value &globalScope) {
+	Value fn = globalMember(globalScope, left, identifier);
+	if (!isFunction(fn)) return nullptr;
+	std::vector<Value> args;
+	for (const auto &itm: pp->getItems()) {
+		Value v;
+		if (itm.expandArray || !getConstant(itm.node, v)) return nullptr;
+		args.push_back(v);
+	}
+	Value r;
+	if (!getFunction(fn).callPure(ValueList(args.data(), args.size()), r) || !isSimpleConstant(r)) {
+		return nullptr;
+	}
+	return constantNode(r);
+}
+
+}
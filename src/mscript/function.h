@@ -31,6 +31,25 @@ public:
 	 */
 	virtual void call(VirtualMachine &vm, const Value &object, const Value &closure) const = 0;
 
+	///Determines, whether function can receive arguments as window on the stack
+	/**
+	 * If true is returned, the function must read arguments through VirtualMachine::top_args()
+	 * and remove them through VirtualMachine::del_args() before the stack is changed. Otherwise
+	 * arguments are always passed as a param pack
+	 */
+	virtual bool acceptsArgWindow() const {return false;}
+
+	///Calls the function without virtual machine, if the function is pure
+	/**
+	 * Pure function has no side effects and its result depends only on its arguments, so
+	 * it can be evaluated during compilation (see INode::fold)
+	 * @param params arguments
+	 * @param out receives result
+	 * @retval true function is pure, result is stored
+	 * @retval false function is not pure, it must be called by the virtual machine
+	 */
+	virtual bool callPure(ValueList params, Value &out) const {return false;}
+
 };
 
 
@@ -53,38 +72,70 @@ static inline const AbstractFunction &getFunction(const Value &v) {
 	return *r;
 }
 
-template<typename Fn, typename = decltype(std::declval<Fn>()(std::declval<VirtualMachine &>(), std::declval<Value>(), std::declval<Value>()))>
-static inline Value defineFunction(Fn &&fn) {
+///Defines native function
+/**
+ * @tparam argWindow function reads arguments through top_args() and del_args() (see AbstractFunction::acceptsArgWindow)
+ * @param fn function
+ * @param pure optional pure variant of the function, which receives arguments and returns
+ * the result without the virtual machine (see AbstractFunction::callPure)
+ */
+template<bool argWindow = false, typename Fn, typename PureFn = std::nullptr_t, typename = decltype(std::declval<Fn>()(std::declval<VirtualMachine &>(), std::declval<Value>(), std::declval<Value>()))>
+static inline Value defineFunction(Fn &&fn, PureFn &&pure = nullptr) {
 	class FnClass: public AbstractFunction {
 	public:
 		virtual void  call(VirtualMachine &vm, const Value &object, const Value &closure) const override {
 			fn(vm, object, closure);
 		}
-		FnClass(Fn &&fn):fn(std::forward<Fn>(fn)) {}
+		virtual bool acceptsArgWindow() const override {return argWindow;}
+		virtual bool callPure(ValueList params, Value &out) const override {
+			if constexpr(std::is_same_v<std::decay_t<PureFn>, std::nullptr_t>) {
+				return false;
+			} else {
+				out = pure(params);
+				return true;
+			}
+		}
+		FnClass(Fn &&fn, PureFn &&pure):fn(std::forward<Fn>(fn)),pure(std::forward<PureFn>(pure)) {}
 	protected:
 		Fn fn;
+		PureFn pure;
 	};
-	auto ptr = std::make_shared<FnClass>(std::forward<Fn>(fn));
+	auto ptr = std::make_shared<FnClass>(std::forward<Fn>(fn), std::forward<PureFn>(pure));
 	return packToValue(std::shared_ptr<AbstractFunction>(std::move(ptr)), {"@FN","native"});
 }
 
-template<typename Fn, typename = decltype(std::declval<Fn>()(std::declval<ValueList>()))>
-static inline Value defineSimpleFn(Fn &&fn) {
-	return defineFunction([fn = std::move(fn)](VirtualMachine &vm, const Value &, const Value &){
-		auto params = vm.top_params();
+///Creates body of native function, which receives arguments as a list and returns the result
+template<typename Fn>
+static inline auto simpleFnCall(Fn fn) {
+	return [fn = std::move(fn)](VirtualMachine &vm, const Value &, const Value &){
+		auto params = vm.top_args();
 		Value ret = fn(params);
-		vm.del_value();
+		vm.del_args();
 		vm.push_value(ret);
+	};
+}
 
-	});
+template<typename Fn, typename = decltype(std::declval<Fn>()(std::declval<ValueList>()))>
+static inline Value defineSimpleFn(Fn &&fn) {
+	return defineFunction<true>(simpleFnCall(std::forward<Fn>(fn)));
+}
+
+///Defines pure function (see AbstractFunction::callPure)
+/**
+ * @param fn function, it must not have side effects
+ */
+template<typename Fn, typename = decltype(std::declval<Fn>()(std::declval<ValueList>()))>
+static inline Value definePureFn(Fn &&fn) {
+	std::decay_t<Fn> pure(fn);
+	return defineFunction<true>(simpleFnCall(std::forward<Fn>(fn)), std::move(pure));
 }
 
 template<typename Fn, typename = decltype(std::declval<Fn>()(std::declval<Value>(),std::declval<ValueList>()))>
 static inline Value defineSimpleMethod(Fn &&fn) {
-	return defineFunction([fn = std::move(fn)](VirtualMachine &vm, const Value &obj, const Value &){
-		auto params = vm.top_params();
+	return defineFunction<true>([fn = std::move(fn)](VirtualMachine &vm, const Value &obj, const Value &){
+		auto params = vm.top_args();
 		Value ret = fn(obj, params);
-		vm.del_value();
+		vm.del_args();
 		vm.push_value(ret);
 	});
 }
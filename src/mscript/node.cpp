@@ -1,6 +1,7 @@
 #include <imtjson/string.h>
 #include <mscript/function.h>
 #include "node.h"
+#include "optimizer.h"
 #include <cmath>
 
 namespace mscript {
@@ -40,12 +41,12 @@ void Identifier::generateAssign(BlockBld &blk) const {
 }*/
 
 void Identifier::generateExpression(BlockBld &blk) const {
-	blk.pushInt(blk.pushConst(name), Cmd::get_var_1,2);
+	blk.loadVar(name);
 }
 
 
 void BlockBld::pushInt(std::intptr_t val, Cmd cmd, int maxSize) {
-	if (cmd == Cmd::set_var_1) lastStorePos = code.size(); else lastStorePos = 0;
+	if (cmd == Cmd::set_var_1 || cmd == Cmd::store_local_1) lastStorePos = code.size(); else lastStorePos = 0;
 	if (val >= -128 && val < 128) {
 		code.push_back(static_cast<std::uint8_t>(cmd));
 		code.push_back(static_cast<std::uint8_t>(val));
@@ -85,6 +86,77 @@ std::intptr_t BlockBld::pushConst(Value v) {
 	return r.first->second;
 }
 
+std::intptr_t BlockBld::pushLocal(Value name) {
+	auto r = localMap.emplace(name, localMap.size());
+	scopes.back().slots.insert(name);
+	return r.first->second;
+}
+
+void BlockBld::pushNamed(Value name) {
+	scopes.back().named.insert(name);
+}
+
+void BlockBld::openScope(ScopeKind kind) {
+	scopes.push_back(ScopeInfo{kind,{},{},{}});
+}
+
+void BlockBld::closeScope() {
+	ScopeInfo &s = scopes.back();
+	//variable assigned later in the loop is visible through the scope of the previous
+	//iteration, so the load must search it by name (same size of the instruction)
+	for (const auto &x: s.pending) {
+		if (s.slots.count(x.first) || s.named.count(x.first)) {
+			auto idx = pushConst(x.first);
+			if (idx > 32767) throw BuildError("Too many constants in the block");
+			code[x.second] = static_cast<std::uint8_t>(Cmd::get_var_2);
+			code[x.second+1] = static_cast<std::uint8_t>(idx >> 8);
+			code[x.second+2] = static_cast<std::uint8_t>(idx & 0xFF);
+		}
+	}
+	scopes.pop_back();
+}
+
+bool BlockBld::resolveLocal(const Value &name, std::size_t &depth, std::intptr_t &slot) const {
+	auto n = scopes.size();
+	for (std::size_t d = 0; d < n; d++) {
+		const ScopeInfo &s = scopes[n-1-d];
+		if (s.slots.count(name)) {
+			depth = d;
+			slot = localMap.find(name)->second;
+			return true;
+		}
+		//variable can be defined by name here, so scopes below are not visible
+		if (s.named.count(name) || s.kind == ScopeKind::dynamic) return false;
+		//loop scope is verified when it is closed (see closeScope)
+	}
+	return false;
+}
+
+bool BlockBld::loadVar(Value name) {
+	std::size_t depth;
+	std::intptr_t slot;
+	if (resolveLocal(name, depth, slot)) {
+		if (depth == 0) {
+			pushInt(slot, Cmd::load_local_1, 2);
+			return true;
+		}
+		if (depth < 128 && slot < 256) {
+			auto pos = code.size();
+			pushCmd(Cmd::load_outer);
+			code.push_back(static_cast<std::uint8_t>(depth));
+			code.push_back(static_cast<std::uint8_t>(slot));
+			lastStorePos = 0;
+			for (std::size_t d = 0; d < depth; d++) {
+				ScopeInfo &s = scopes[scopes.size()-1-d];
+				if (s.kind == ScopeKind::loop) s.pending.push_back({name, pos});
+			}
+			return true;
+		}
+	}
+	pushInt(pushConst(name), Cmd::get_var_1, 2);
+	return false;
+}
+
 void Identifier::generateListVars(VarSet &vars) const {
 	vars.insert(name);
 }
@@ -114,12 +186,17 @@ void FunctionCall::generateListVars(VarSet &vars) const {
 }
 
 void FunctionCall::generateExpression(BlockBld &blk) const {
-	paramPack->generateExpression(blk);
+	int argw = paramPack->generateArgWindow(blk);
+	if (argw < 0) paramPack->generateExpression(blk);
 	auto ident = dynamic_cast<const Identifier *>(fn.get());
-	if (ident) {
+	std::size_t depth;
+	std::intptr_t slot;
+	if (ident && !blk.resolveLocal(ident->getName(), depth, slot)) {
+		if (argw >= 0) blk.pushInt(argw, Cmd::arg_window, 1);
 		blk.pushInt(blk.pushConst(ident->getName()), Cmd::call_1, 2);
 	} else {
 		fn->generateExpression(blk);
+		if (argw >= 0) blk.pushInt(argw, Cmd::arg_window, 1);
 		blk.pushCmd(Cmd::call);
 	}
 }
@@ -158,10 +235,12 @@ void KwWithNode::pushScope(BlockBld &blk) const {
 	if (vs.find("this") != vs.end()) {
 		blk.pushCmd(Cmd::dup);
 		blk.pushCmd(Cmd::push_scope_object);
+		blk.openScope(BlockBld::ScopeKind::dynamic);
+		blk.pushNamed("this");
 		blk.pushInt(blk.pushConst("this"), Cmd::set_var_1, 2);
 	} else {
 		blk.pushCmd(Cmd::push_scope_object);
-
+		blk.openScope(BlockBld::ScopeKind::dynamic);
 	}
 }
 
@@ -170,13 +249,16 @@ void KwWithNode::generateExpression(BlockBld &blk) const {
 	pushScope(blk);
 	ExecNode::generateExpression(blk);
 	blk.pushCmd(Cmd::pop_scope);
+	blk.closeScope();
 }
 
 
 void KwExecNode::generateExpression(BlockBld &blk) const {
 	blk.pushCmd(Cmd::push_scope);
+	blk.openScope(BlockBld::ScopeKind::plain);
 	ExecNode::generateExpression(blk);
 	blk.pushCmd(Cmd::pop_scope);
+	blk.closeScope();
 }
 
 void KwExecObjectNode::generateExpression(BlockBld &blk) const {
@@ -186,14 +268,17 @@ void KwExecObjectNode::generateExpression(BlockBld &blk) const {
 	BlockNode::optimizeStoreDel(blk);
 	blk.pushCmd(Cmd::scope_to_object);	 //convert scope to object <return value is object>
 	blk.pushCmd(Cmd::pop_scope);		 //pop scope
+	blk.closeScope();
 }
 
 void KwExecNewObjectNode::generateExpression(BlockBld &blk) const {
 	blk.pushCmd(Cmd::push_scope);
+	blk.openScope(BlockBld::ScopeKind::plain);
 	ExecNode::generateExpression(blk);
 	BlockNode::optimizeStoreDel(blk);
 	blk.pushCmd(Cmd::scope_to_object);
 	blk.pushCmd(Cmd::pop_scope);
+	blk.closeScope();
 }
 
 IfElseNode::IfElseNode(PNode &&cond, PNode &&nd_then, PNode &&nd_else)
@@ -250,8 +335,13 @@ void MethodCallNode::generateExpression(BlockBld &blk) const {
 		blk.pushInt(blk.pushConst(identifier), Cmd::mcall_1,2); //<value list> <result>
 		blk.pushCmd(Cmd::combine);						//<result>
 	} else {
-		pp->generateExpression(blk);					//<object> <params>
-		blk.pushCmd(Cmd::swap);							//<params> <object>
+		int argw = pp->generateArgWindow(blk);			//<object> <args...>
+		if (argw >= 0) {
+			blk.pushInt(argw, Cmd::arg_window, 1);
+		} else {
+			pp->generateExpression(blk);				//<object> <params>
+			blk.pushCmd(Cmd::swap);						//<params> <object>
+		}
 		blk.pushInt(blk.pushConst(identifier), Cmd::mcall_1,2);
 	}
 }
@@ -264,7 +354,7 @@ class FunctionTask: public BlockExecution {
 public:
 	///Requires identifiers and block
 	FunctionTask(const UserFn &fn, const Value &object, const Value &closure)
-		:BlockExecution(fn.getCode()),fn(fn) ,object(object),closure(closure) {}
+		:BlockExecution(fn.getCode()),fn(&fn) ,object(object),closure(closure) {}
 
 	///Called during init
 	/**
@@ -282,23 +372,24 @@ public:
 		}
 		++scopes;
 
-		auto args = vm.top_params();
+		auto args = vm.top_args();
 		std::size_t idx = 0;
-		const auto &identifiers = fn.getIdentifiers();
+		const auto &identifiers = fn->getIdentifiers();
 		auto i = identifiers.begin();
-		bool expl = fn.is_expand_all() && !identifiers.empty();
+		bool expl = fn->is_expand_all() && !identifiers.empty();
 		auto e = expl?(identifiers.begin()+identifiers.size()-1):identifiers.end();
 		while (i != e) {
-			vm.set_var(*i, args[idx]);
+			setArg(vm, idx, *i, args[idx]);
 			++i;
 			++idx;
 		}
 		if (expl) {
-			vm.set_var(identifiers.back(),args.toValue().slice(identifiers.size()-1));
+			setArg(vm, idx, identifiers.back(),args.toValue().slice(identifiers.size()-1));
 		}
-		vm.del_value();
+		vm.del_args();
 		if (object.defined()) vm.set_var(thisVal, object);
 		if (closure.defined()) vm.set_var(closureVal, closure);
+		scopeLevel = vm.getScopeStack().size();
 
 		return BlockExecution::init(vm);
 	}
@@ -306,7 +397,8 @@ public:
 	/**
 	 * @param vm virtual machine
 	 *
-	 * when function exits, removes scope from the virtual machine
+	 * when function exits, removes scope from the virtual machine. If the function
+	 * ended by a tail call, the task is reused to execute the called function
 	 */
 	virtual bool run(VirtualMachine &vm) {
 		if (!BlockExecution::run(vm)) {
@@ -314,18 +406,76 @@ public:
 				vm.pop_scope();
 				--scopes;
 			}
-			return false;
-		} else {
-			return true;
+			if (!tailFn.defined()) return false;
+			try {
+				closure = std::move(tailFn);
+				object = std::move(tailObject);
+				tailFn = Value();
+				tailObject = Value();
+				fn = static_cast<const UserFn *>(&getFunction(closure));
+				restart(fn->getCode());
+				init(vm);
+			} catch (...) {
+				vm.raise(std::current_exception());
+			}
 		}
+		return true;
+	}
+
+	///Tail call of a user function reuses this task and its frame
+	virtual bool tail_call(VirtualMachine &vm, const Value &fnval, const Value &obj) override {
+		if (!isFunction(fnval)) return false;
+		auto ufn = dynamic_cast<const UserFn *>(&getFunction(fnval));
+		if (!ufn || !canReleaseScopes(vm, *ufn, obj)) return false;
+		vm.bind_args(*ufn);
+		tailFn = fnval;
+		tailObject = obj;
+		//finish current block, arguments stay on the stack
+		ip = block->code.size();
+		return true;
 	}
 
 protected:
+	///Determines, whether scopes of this function can be released before the called function starts
+	/**
+	 * Scoping is dynamic, the called function can see variables of the caller. So the scopes
+	 * can be released only, when each variable of the caller is shadowed by a variable, which
+	 * is defined by the called function before it starts (arguments, this and closure).
+	 * Object and closure scopes of the caller are never released
+	 */
+	bool canReleaseScopes(const VirtualMachine &vm, const UserFn &callee, const Value &obj) const {
+		const auto &stack = vm.getScopeStack();
+		if (scopes != 1 || stack.size() != scopeLevel) return false;
+		const auto &identifiers = callee.getIdentifiers();
+		bool shadowed = true;
+		stack.back().forEach([&](const Value &name, const Value &) {
+			if (name == closureVal) return;
+			if (name == thisVal && obj.defined()) return;
+			if (std::find(identifiers.begin(), identifiers.end(), name) == identifiers.end()) shadowed = false;
+		});
+		return shadowed;
+	}
+
+	///arguments have slots in order of identifiers (see defineUserFunction)
+	void setArg(VirtualMachine &vm, std::size_t idx, const Value &name, const Value &value) {
+		const auto &locals = block->locals;
+		if (idx < locals.size() && locals[idx] == name) {
+			vm.set_local(block_value, idx, name, block->localHashes[idx], value);
+		} else {
+			vm.set_var(name, value);
+		}
+	}
+
 	int scopes = 0;
-	///identifiers are used only during init - so it can be const
-	const UserFn &fn;
+	///size of the scope stack, when the function started
+	std::size_t scopeLevel = 0;
+	///executed function, it is held by the closure
+	const UserFn *fn;
 	Value object;
 	Value closure;
+	///function called in tail position (see tail_call)
+	Value tailFn;
+	Value tailObject;
 };
 
 
@@ -335,7 +485,7 @@ void UserFn::call(VirtualMachine &vm, const Value &object, const Value &closure)
 
 
 Value defineUserFunction(std::vector<Value> &&identifiers, bool expand_last, PNode &&body, const CodeLocation &loc) {
-	Value code = packToValue(buildCode(body, loc));
+	Value code = packToValue(buildCode(body, loc, identifiers));
 	auto ptr = std::make_unique<UserFn>(std::move(code), std::move(identifiers), expand_last);
 	Value name = {"@FN",loc.file, loc.line};
 	return packToValue(std::unique_ptr<AbstractFunction>(std::move(ptr)), name);
@@ -349,32 +499,45 @@ public:
 	}
 };
 
+static Block buildCode(BlockBld &bld, const PNode &nd, const CodeLocation &loc) {
+	nd->generateExpression(bld);
+	Block out;
+	out.consts.resize(bld.constMap.size());
+	for (const auto &itm: bld.constMap) {
+		out.consts[itm.second] = itm.first;
+	}
+	out.locals.resize(bld.localMap.size());
+	for (const auto &itm: bld.localMap) {
+		out.locals[itm.second] = itm.first;
+	}
+	out.code = std::move(bld.code);
+	out.lines = std::move(bld.lines);
+	std::sort(out.lines.begin(),out.lines.end(),std::greater());
+	out.location = loc;
+	optimizeBlock(out);
+	out.hashNames();
+	return out;
+}
+
 Block buildCode(const PNode &nd, const CodeLocation &loc, bool compile_time) {
 	BlockBld bld;
 	FakeBreakHandler fkbrk;
 	if (compile_time) {
 		bld.brkhndl = &fkbrk;
 	}
-	nd->generateExpression(bld);
-	std::vector<Value> consts;
-	consts.resize(bld.constMap.size());
-	for (const auto &itm: bld.constMap) {
-		consts[itm.second] = itm.first;
-	}
-	auto lines = std::move(bld.lines);
-	std::sort(lines.begin(),lines.end(),std::greater());
+	return buildCode(bld, nd, loc);
+}
 
-	return {
-		consts,
-		bld.code,
-		lines,
-		loc
-	};
+Block buildCode(const PNode &nd, const CodeLocation &loc, const std::vector<Value> &locals) {
+	BlockBld bld;
+	for (const auto &x: locals) bld.pushLocal(x);
+	return buildCode(bld, nd, loc);
 }
 
 void BlockNode::optimizeStoreDel(BlockBld &blk) {
 	if (blk.lastStorePos) {
 		constexpr auto diff = static_cast<int>(Cmd::pop_var_1)-static_cast<int>(Cmd::set_var_1);
+		static_assert(diff == static_cast<int>(Cmd::pop_local_1)-static_cast<int>(Cmd::store_local_1));
 		blk.code[blk.lastStorePos]+=diff;
 		blk.lastStorePos = 0;
 	} else {
@@ -438,51 +601,45 @@ void ForLoopNode::generateExpression(BlockBld &blk) const {
 		blk.pushCmd(Cmd::push_null);
 	} else {
 		blk.pushCmd(Cmd::push_scope);
+		blk.openScope(BlockBld::ScopeKind::plain);
 		for (const auto &x: init) {
 			x.second->generateExpression(blk);
+			blk.pushNamed(x.first);
 			blk.pushInt(blk.pushConst(x.first), Cmd::pop_var_1, 2);
 		}
 		blk.pushCmd(Cmd::scope_to_object);
 		blk.pushCmd(Cmd::pop_scope);
+		blk.closeScope();
 	}
 	// <scope>
-	container->generateExpression(blk);
+	container->generateExpression(blk);	//<scope><container>
+	blk.pushCmd(Cmd::iter_begin);		//<scope>
 	std::vector<std::size_t> regjumps;
 	auto brkh = setBreakHandler(blk, [&](BlockBld &blk){
-		blk.pushCmd(Cmd::del);			//<scope><container>
-		blk.pushCmd(Cmd::del);			//<scope>
+		blk.pushCmd(Cmd::iter_end);		//<scope>
 		blk.pushCmd(Cmd::del);			//
-		blk.pushCmd(Cmd::scope_to_object);	//<scope><container><idx><scope>
+		blk.pushCmd(Cmd::scope_to_object);	//<scope>
 		blk.pushCmd(Cmd::pop_scope);
 		regjumps.push_back(blk.prepareJump(Cmd::jump_1, 2));
 		return false;
 	});
 
-	// <scope><container>
-	blk.pushCmd(Cmd::push_zero_int);
-	// <scope><container><idx>
 	auto label = blk.code.size();
-	blk.pushInt(1, Cmd::dup_1, 1);  //<scope><container><idx><container>
-	blk.pushInt(1, Cmd::dup_1, 1);	//<scope><container><idx><container><idx>
-	blk.pushCmd(Cmd::op_checkbound); //<scope><container><idx><bool>
-	auto jpout = blk.prepareJump(Cmd::jump_false_1, 2); //<ret><scope><container><idx>
-	blk.pushInt(2, Cmd::dup_1, 1);	//<scope><container><idx><scope>
-	blk.pushCmd(Cmd::push_scope_object); //<scope><container><idx>
-	blk.pushInt(1, Cmd::dup_1, 1);  //<scope><container><idx><container>
-	blk.pushInt(1, Cmd::dup_1, 1);	//<scope><container><idx><container><idx>
-	blk.pushCmd(Cmd::deref);		//<scope><container><idx><value>
-	blk.pushInt(blk.pushConst(iterator), Cmd::pop_var_1, 2); //<scope><container><idx>
-	block->generateExpression(blk);	//generate block execution <scope><container><idx><ret>
-	BlockNode::optimizeStoreDel(blk);	//<scope><container><idx> - return value is ignored
-	blk.pushCmd(Cmd::scope_to_object);	//<scope><container><idx><scope>
+	auto jpout = blk.prepareJump(Cmd::iter_next_1, 2); //<scope><value>
+	blk.pushInt(1, Cmd::dup_1, 1);	//<scope><value><scope>
+	blk.pushCmd(Cmd::push_scope_object); //<scope><value>
+	blk.openScope(BlockBld::ScopeKind::loop);
+	for (const auto &x: init) blk.pushNamed(x.first);	//defined by the base object
+	blk.pushInt(blk.pushLocal(iterator), Cmd::pop_local_1, 2); //<scope>
+	block->generateExpression(blk);	//generate block execution <scope><ret>
+	BlockNode::optimizeStoreDel(blk);	//<scope> - return value is ignored
+	blk.pushCmd(Cmd::scope_to_object);	//<scope><new scope>
 	blk.pushCmd(Cmd::pop_scope);
-	blk.pushInt(3, Cmd::swap_1, 1);	//swap old scope with new scope
-	blk.pushCmd(Cmd::del);			//<scope><container><idx>
-	blk.pushInt(1,Cmd::op_add_const_1,8); //<scope><container><idx+1>
+	blk.closeScope();
+	blk.pushCmd(Cmd::swap);			//swap old scope with new scope
+	blk.pushCmd(Cmd::del);			//<new scope>
 	blk.finishJumpTo(blk.prepareJump(Cmd::jump_1, 2), label,2);
-	blk.finishJumpHere(jpout, 2);	//<scope><container><idx>
-	blk.pushCmd(Cmd::del);			//<scope><container>
-	blk.pushCmd(Cmd::del);			//<scope>
+	blk.finishJumpHere(jpout, 2);	//<scope>
 	for (const auto &x: regjumps) {
 		blk.finishJumpHere(x, 2);
 	}
@@ -500,6 +657,7 @@ void WhileLoopNode::generateExpression(BlockBld &blk) const {
 	auto skp = blk.prepareJump(Cmd::jump_false_1, 2);
 	auto rephere = blk.code.size();
 	blk.pushCmd(Cmd::push_scope_object);	//
+	blk.openScope(BlockBld::ScopeKind::loop);
 	std::vector<std::size_t> brkjmps;
 	auto brkhndl = setBreakHandler(blk, [&](BlockBld &blk){
 		blk.pushCmd(Cmd::scope_to_object);		//<scope>
@@ -512,6 +670,7 @@ void WhileLoopNode::generateExpression(BlockBld &blk) const {
 	blk.pushCmd(Cmd::scope_to_object);		//<scope>
 	condition->generateExpression(blk);		//<scope> <condition>
 	blk.pushCmd(Cmd::pop_scope);
+	blk.closeScope();
 	blk.finishJumpTo(blk.prepareJump(Cmd::jump_true_1, 2), rephere, 2); //<scope>
 	blk.finishJumpHere(skp, 2);
 	for (const auto &x: brkjmps) {
@@ -524,7 +683,7 @@ SimpleAssignNode::SimpleAssignNode(Value ident):ident(ident) {
 }
 
 void SimpleAssignNode::generateExpression(BlockBld &blk) const {
-	blk.pushInt(blk.pushConst(ident.toString()), Cmd::set_var_1,2);
+	blk.pushInt(blk.pushLocal(ident.toString()), Cmd::store_local_1,2);
 }
 
 PackAssignNode::PackAssignNode(std::vector<Value> &&idents, Value expandIdent)
@@ -537,10 +696,12 @@ void PackAssignNode::generateExpression(BlockBld &blk) const {
 		Value is(json::array,
 				idents.begin(),
 				idents.end(),[](Value x){return x;});
+		for (const auto &x: idents) blk.pushNamed(x);
 		blk.pushInt(blk.pushConst(is), Cmd::set_var_1,2);
 	}
 	if (expandIdent.defined()) {
 		blk.pushInt(idents.size(), Cmd::collapse_list_1, 1);
+		blk.pushNamed(expandIdent);
 		blk.pushInt(blk.pushConst(expandIdent), Cmd::set_var_1,2);
 	}
 }
@@ -715,9 +876,22 @@ void SwitchCaseNode::generateExpression(BlockBld &blk) const {
 	std::vector<std::size_t> lbofs;
 	std::vector<std::size_t> begins;
 	std::vector<std::size_t> jumps;
-	for (const auto &l: labels) {
-		blk.pushInt(blk.pushConst(l.first),Cmd::op_cmp_eq_1,2);
-		lbofs.push_back(blk.prepareJump(Cmd::jump_true_1, 2));
+	std::vector<Value> tblLabels;
+	for (const auto &l: labels) tblLabels.push_back(l.first);
+	//when labels allow it, use jump table, otherwise compare selector with each label
+	bool useTable = SwitchTable::isSuitable(tblLabels);
+	std::size_t tblofs = 0;
+	if (useTable) {
+		//index of the table is known when the code of all cases is generated
+		blk.pushCmd(Cmd::switch_table_2);
+		tblofs = blk.code.size();
+		blk.code.push_back(0);
+		blk.code.push_back(0);
+	} else {
+		for (const auto &l: labels) {
+			blk.pushInt(blk.pushConst(l.first),Cmd::op_cmp_eq_1,2);
+			lbofs.push_back(blk.prepareJump(Cmd::jump_true_1, 2));
+		}
 	}
 	if (defNode != nullptr) {
 		blk.pushCmd(Cmd::del);
@@ -733,10 +907,19 @@ void SwitchCaseNode::generateExpression(BlockBld &blk) const {
 		blk.finishJumpHere(x, 2);
 	}
 	blk.finishJumpHere(skp, 2);
-	std::size_t i = 0;
-	for (const auto &l: labels) {
-		blk.finishJumpTo(lbofs[i], begins[l.second], 2);
-		i++;
+	if (useTable) {
+		std::vector<std::size_t> targets;
+		for (const auto &l: labels) targets.push_back(begins[l.second]);
+		auto idx = blk.pushConst(packToValue(SwitchTable(std::move(tblLabels), std::move(targets))));
+		if (idx >= 32768) throw BuildError("Too many constants in the block, switch table cannot be stored");
+		blk.code[tblofs] = static_cast<std::uint8_t>(idx>>8);
+		blk.code[tblofs+1] = static_cast<std::uint8_t>(idx & 0xFF);
+	} else {
+		std::size_t i = 0;
+		for (const auto &l: labels) {
+			blk.finishJumpTo(lbofs[i], begins[l.second], 2);
+			i++;
+		}
 	}
 
 }
@@ -799,6 +982,18 @@ void ValueListNode::generateExpression(BlockBld &blk) const {
 	}
 }
 
+int ValueListNode::generateArgWindow(BlockBld &blk) const {
+	//single value is passed without list, other values returning list must be packed
+	if (items.size() == 1 || items.size() > 127) return -1;
+	for (const Item &x: items) {
+		if (x.expandArray || MethodCallNode::canReturnValueList(x.node)) return -1;
+	}
+	for (const Item &x: items) {
+		x.node->generateExpression(blk);
+	}
+	return static_cast<int>(items.size());
+}
+
 void ValueListNode::generateListVars(VarSet &vars) const {
 	for (const Item &x: items) {
 		x.node->generateListVars(vars);
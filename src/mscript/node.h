@@ -26,11 +26,41 @@ namespace mscript {
 
 	struct BlockBld {
 		std::unordered_map<Value, std::intptr_t> constMap;
+		std::unordered_map<Value, std::intptr_t> localMap;
 		std::vector<std::uint8_t> code;
 		std::vector<std::pair<std::size_t,std::size_t> > lines; //<code, line>
 		void pushInt(std::intptr_t val, Cmd cmd, int maxSize);
 		void pushCmd(Cmd cmd);
 		std::intptr_t pushConst(Value v);
+		///Allocates slot for local variable (or returns existing) and marks it assigned in the current scope
+		std::intptr_t pushLocal(Value name);
+		///Marks variable, which is assigned by name in the current scope (not through a slot)
+		void pushNamed(Value name);
+
+		///Kind of the scope created by the code (see openScope)
+		enum class ScopeKind {
+			///new empty scope
+			plain,
+			///scope of the loop, its base object is the scope of previous iteration, so it
+			///contains only variables assigned in the loop
+			loop,
+			///scope with an unknown base object (with, exec object), any variable can be defined there
+			dynamic
+		};
+		///Tracks scope created by the code - must be called with push_scope or push_scope_object
+		void openScope(ScopeKind kind);
+		///Tracks end of the scope - must be called with pop_scope
+		void closeScope();
+		///Generates instruction, which pushes value of variable
+		/**
+		 * Variable assigned to a slot in current or an enclosing scope is loaded directly
+		 * from that slot (load_local, load_outer). Other variables are searched by name
+		 * (get_var)
+		 * @param name name of variable
+		 * @retval true loaded from a slot
+		 * @retval false loaded by name
+		 */
+		bool loadVar(Value name);
 		std::size_t lastStorePos;
 
 		std::size_t prepareJump(Cmd cmd, int sz);
@@ -40,6 +70,19 @@ namespace mscript {
 
 		IBreakHandler *brkhndl = nullptr;
 
+		struct ScopeInfo {
+			ScopeKind kind;
+			///variables assigned to slots so far
+			std::unordered_set<Value> slots;
+			///variables assigned by name (or defined by base object)
+			std::unordered_set<Value> named;
+			///loads from outer scopes passed through this loop scope: name, position of instruction
+			std::vector<std::pair<Value, std::size_t> > pending;
+		};
+		///scopes created by the code, first item is the scope, where the code starts
+		std::vector<ScopeInfo> scopes = std::vector<ScopeInfo>(1, ScopeInfo{ScopeKind::plain,{},{},{}});
+		///Finds slot and depth of variable, returns false, if it must be searched by name
+		bool resolveLocal(const Value &name, std::size_t &depth, std::intptr_t &slot) const;
 
 	};
 
@@ -101,10 +144,35 @@ namespace mscript {
 		///Generate code as expression
 		virtual void generateExpression(BlockBld &blk) const =0;
 		virtual void generateListVars(VarSet &vars) const = 0;
+		///Simplifies the node, if its value is known during compilation (constant folding)
+		/**
+		 * @param globalScope global scope, used to resolve pure functions (Math.sin, etc)
+		 * @return simplified node, or nullptr if the node cannot be simplified. The node can
+		 * move its children to the result, so it must be discarded if a node is returned
+		 */
+		virtual std::unique_ptr<INode> fold(const Value &globalScope) {return nullptr;}
 	};
 
 	using PNode = std::unique_ptr<INode>;
 
+	///Folds the node (see INode::fold)
+	/**
+	 * @param nd node
+	 * @param globalScope global scope
+	 * @return simplified node, or the original node
+	 */
+	PNode foldConstants(PNode &&nd, const Value &globalScope);
+	///Retrieves value of the node, if the node is a constant
+	/**
+	 * @param nd node
+	 * @param out receives value
+	 * @retval true node is constant
+	 * @retval false node is not constant
+	 */
+	bool getConstant(const PNode &nd, Value &out);
+	///Creates node which generates the constant
+	PNode constantNode(Value v);
+
 	class Expression: public INode {
 	public:
 	};
@@ -119,6 +187,7 @@ namespace mscript {
 		BinaryOperation(PNode &&left, PNode &&right, Cmd instruction);
 		virtual void generateExpression(BlockBld &blk) const;
 		virtual void generateListVars(VarSet &vars) const override;
+		virtual PNode fold(const Value &globalScope) override;
 		const PNode &getLeft() const {return left;}
 		const PNode &getRight() const {return right;}
 	protected:
@@ -159,6 +228,7 @@ namespace mscript {
 		UnaryOperation(PNode &&item, Cmd instruction);
 		virtual void generateExpression(BlockBld &blk) const;
 		virtual void generateListVars(VarSet &vars) const override;
+		virtual PNode fold(const Value &globalScope) override;
 	protected:
 		PNode item;
 		Cmd instruction;
@@ -223,6 +293,13 @@ namespace mscript {
 		virtual void generateExpression(BlockBld &blk) const override;
 		virtual void generateListVars(VarSet &vars) const override;
 		const Items &getItems() const {return items;}
+		///Generates arguments as a window on the stack, if possible (see Cmd::arg_window)
+		/**
+		 * @param blk block
+		 * @return count of arguments in the window, or -1 if window is not possible, in this
+		 * case, nothing is generated
+		 */
+		int generateArgWindow(BlockBld &blk) const;
 	protected:
 		Items items;
 	};
@@ -287,6 +364,7 @@ namespace mscript {
 	class DirectCmdNode: public ConstantLeaf {
 	public:
 		DirectCmdNode(Cmd cmd);
+		Cmd getCmd() const {return cmd;}
 	protected:
 		Cmd cmd;
 		virtual void generateExpression(BlockBld &blk) const override;
@@ -353,6 +431,7 @@ namespace mscript {
 		IfElseNode(PNode &&cond, PNode &&nd_then, PNode &&nd_else);
 		virtual void generateExpression(BlockBld &blk) const override;
 		virtual void generateListVars(VarSet &vars) const override;
+		virtual PNode fold(const Value &globalScope) override;
 	protected:
 		PNode cond;
 		PNode nd_then;
@@ -371,6 +450,7 @@ namespace mscript {
 		DerefernceDotNode(PNode &&left, Value identifier);
 		virtual void generateExpression(BlockBld &blk) const override;
 		virtual void generateListVars(VarSet &vars) const override;
+		virtual PNode fold(const Value &globalScope) override;
 		const PNode &getLeft() const {return left;}
 		const Value getIdentifier() const {return identifier;}
 	protected:
@@ -383,6 +463,7 @@ namespace mscript {
 		MethodCallNode(PNode &&left, Value identifier, PValueListNode &&pp);
 		virtual void generateExpression(BlockBld &blk) const override;
 		virtual void generateListVars(VarSet &vars) const override;
+		virtual PNode fold(const Value &globalScope) override;
 		static bool canReturnValueList(const PNode &nd) ;
 	protected:
 		PNode left;
@@ -401,6 +482,15 @@ namespace mscript {
 	 * @return code in block
 	 */
 	Block buildCode(const PNode &nd, const CodeLocation &loc, bool compile_time = false);
+	///Build code of the block, where some local variables are already defined (for example arguments of function)
+	/**
+	 * @param nd node
+	 * @param loc location
+	 * @param locals list of local variables defined before the block starts. They receives
+	 * slots in the same order
+	 * @return block
+	 */
+	Block buildCode(const PNode &nd, const CodeLocation &loc, const std::vector<Value> &locals);
 
 	class BlockNode: public Expression {
 	public:
@@ -428,6 +518,7 @@ namespace mscript {
 		BooleanAndOrNode(PNode &&left,PNode &&right, bool and_node);
 		virtual void generateExpression(BlockBld &blk) const override;
 		virtual void generateListVars(VarSet &vars) const override;
+		virtual PNode fold(const Value &globalScope) override;
 	protected:
 		PNode left;
 		PNode right;
@@ -464,6 +555,7 @@ namespace mscript {
 		UserFn(Value &&code, std::vector<Value> &&identifiers, bool expand_last)
 			:code(std::move(code)), identifiers(identifiers),expand_last(expand_last) {}
 		virtual void call(VirtualMachine &vm, const Value &object, const Value &closure) const override;
+		virtual bool acceptsArgWindow() const override {return true;}
 		const Value& getCode() const {return code;}
 		const std::vector<Value>& getIdentifiers() const {return identifiers;}
 		bool is_expand_all() const {return expand_last;}
@@ -507,6 +599,7 @@ namespace mscript {
 		using Labels = std::vector<std::pair<Value, std::size_t> >;
 		using Nodes = std::vector<PNode>;
 		SwitchCaseNode(PNode &&selector, Labels &&labels, Nodes &&nodes, PNode &&defaultNode);
+		virtual PNode fold(const Value &globalScope) override;
 	protected:
 		virtual void generateExpression(BlockBld &blk) const override;
 		virtual void generateListVars(VarSet &vars) const override;
@@ -0,0 +1,413 @@
+/*
+ * optimizer.cpp
+ *
+ *  Created on: 18. 10. 2026
+ *      Author: ondra
+ */
+
+#include <iterator>
+#include "optimizer.h"
+
+namespace mscript {
+
+namespace {
+
+///Describes family of jump instructions (variants with different size of the operand)
+struct JumpFamily {
+	Cmd cmd1;	///<1 byte variant
+	Cmd cmd2;	///<2 bytes variant
+	bool unconditional; ///<jump is unconditional
+	bool consumes; ///<jump consumes value from the stack
+	bool effect; ///<instruction has other effect than the jump, it cannot be removed
+};
+
+static const JumpFamily jumpFamilies[] = {
+		{Cmd::jump_1, Cmd::jump_2, true, false, false},
+		{Cmd::jump_true_1, Cmd::jump_true_2, false, true, false},
+		{Cmd::jump_false_1, Cmd::jump_false_2, false, true, false},
+		{Cmd::iter_next_1, Cmd::iter_next_2, false, false, true},
+};
+
+static constexpr int jfJump = 0;
+static constexpr int jfJumpTrue = 1;
+static constexpr int jfJumpFalse = 2;
+
+static int findJumpFamily(Cmd cmd) {
+	for (std::size_t i = 0; i < std::size(jumpFamilies); i++) {
+		if (jumpFamilies[i].cmd1 == cmd || jumpFamilies[i].cmd2 == cmd) return static_cast<int>(i);
+	}
+	return -1;
+}
+
+static bool isPurePush(Cmd cmd) {
+	switch (cmd) {
+		case Cmd::push_int_1:
+		case Cmd::push_int_2:
+		case Cmd::push_int_4:
+		case Cmd::push_int_8:
+		case Cmd::push_double:
+		case Cmd::push_const_1:
+		case Cmd::push_const_2:
+		case Cmd::push_true:
+		case Cmd::push_false:
+		case Cmd::push_null:
+		case Cmd::push_undefined:
+		case Cmd::push_zero_int:
+		case Cmd::dup: return true;
+		default: return false;
+	}
+}
+
+static bool fitsOperand(std::int64_t v, int sz) {
+	switch (sz) {
+		case 1: return v >= -128 && v < 128;
+		case 2: return v >= -32768 && v < 32768;
+		case 4: return v >= -2147483648LL && v <= 2147483647LL;
+		default: return true;
+	}
+}
+
+struct Instr {
+	///instruction
+	Cmd cmd;
+	///operand (signed)
+	std::int64_t operand;
+	///size of operand in bytes
+	int opsize;
+	///jump family, -1 if not jump
+	int jump;
+	///index of target instruction (for jumps)
+	std::size_t target;
+	///original position in the code
+	std::size_t origPos;
+	///instruction was removed
+	bool removed;
+};
+
+///Instruction switch_table - its targets are stored in the table
+struct SwitchSite {
+	///index of the instruction
+	std::size_t instr;
+	///index of the table in constants
+	std::size_t cindex;
+	///indexes of target instructions (one for each label)
+	std::vector<std::size_t> targets;
+};
+
+class Optimizer {
+public:
+	bool load(const Block &block);
+	void optimize();
+	bool store(Block &block);
+
+protected:
+	std::vector<Instr> instrs;
+	std::vector<bool> labels;
+	std::vector<SwitchSite> switches;
+
+	std::size_t resolve(std::size_t i) const {
+		while (i < instrs.size() && instrs[i].removed) ++i;
+		return i;
+	}
+	std::size_t next(std::size_t i) const {
+		return resolve(i+1);
+	}
+	///retrieves instruction which is not jump target - so it can be part of a sequence
+	Instr *inner(std::size_t i) {
+		if (i >= instrs.size() || labels[i]) return nullptr;
+		return &instrs[i];
+	}
+	void remove(std::size_t i) {
+		instrs[i].removed = true;
+	}
+	static void setJump(Instr &x, int family, std::size_t target) {
+		x.cmd = jumpFamilies[family].cmd1;
+		x.jump = family;
+		x.opsize = 1;
+		x.operand = 0;
+		x.target = target;
+	}
+	static void setSimple(Instr &x, Cmd cmd) {
+		x.cmd = cmd;
+		x.jump = -1;
+		x.opsize = 0;
+		x.operand = 0;
+	}
+
+	void updateLabels();
+	bool removeNoops();
+	bool fuse();
+	bool threadJumps();
+	void markTailCalls();
+};
+
+bool Optimizer::load(const Block &block) {
+	const auto &code = block.code;
+	constexpr auto npos = static_cast<std::size_t>(-1);
+	std::vector<std::size_t> posToIdx(code.size()+1, npos);
+	std::size_t pos = 0;
+	while (pos < code.size()) {
+		Cmd cmd = static_cast<Cmd>(code[pos]);
+		int opsize = static_cast<int>(getCmdOperandSize(cmd));
+		if (pos + 1 + opsize > code.size()) return false;
+		std::uint64_t u = 0;
+		if (opsize) {
+			u = (code[pos+1] & 0x80)?~std::uint64_t(0):0;
+			for (int i = 0; i < opsize; i++) u = (u << 8) | code[pos+1+i];
+		}
+		posToIdx[pos] = instrs.size();
+		instrs.push_back({cmd, static_cast<std::int64_t>(u), opsize, findJumpFamily(cmd), 0, pos, false});
+		pos += 1 + opsize;
+	}
+	posToIdx[code.size()] = instrs.size();
+	for (auto &x: instrs) {
+		if (x.jump >= 0) {
+			std::int64_t t = static_cast<std::int64_t>(x.origPos + 1 + x.opsize) + x.operand;
+			if (t < 0 || t > static_cast<std::int64_t>(code.size())) return false;
+			auto idx = posToIdx[t];
+			if (idx == npos) return false;
+			x.target = idx;
+		}
+	}
+	for (std::size_t i = 0; i < instrs.size(); i++) {
+		const Instr &x = instrs[i];
+		if (x.cmd != Cmd::switch_table_1 && x.cmd != Cmd::switch_table_2) continue;
+		auto cindex = static_cast<std::size_t>(x.operand);
+		if (cindex >= block.consts.size() || !isSwitchTable(block.consts[cindex])) return false;
+		//the table is rewritten by the store(), so it must not be shared
+		for (const auto &sw: switches) if (sw.cindex == cindex) return false;
+		SwitchSite site{i, cindex, {}};
+		for (auto t: getSwitchTableFromValue(block.consts[cindex]).getTargets()) {
+			if (t > code.size() || posToIdx[t] == npos) return false;
+			site.targets.push_back(posToIdx[t]);
+		}
+		switches.push_back(std::move(site));
+	}
+	return true;
+}
+
+void Optimizer::updateLabels() {
+	labels.assign(instrs.size()+1, false);
+	for (const auto &x: instrs) {
+		if (!x.removed && x.jump >= 0) labels[resolve(x.target)] = true;
+	}
+	for (const auto &sw: switches) {
+		for (auto t: sw.targets) labels[resolve(t)] = true;
+	}
+}
+
+bool Optimizer::removeNoops() {
+	bool changed = false;
+	for (auto &x: instrs) {
+		if (!x.removed && x.cmd == Cmd::noop) {
+			x.removed = true;
+			changed = true;
+		}
+	}
+	return changed;
+}
+
+bool Optimizer::fuse() {
+	bool changed = false;
+	updateLabels();
+	auto n = instrs.size();
+	for (std::size_t i = resolve(0); i < n; i = next(i)) {
+		Instr &a = instrs[i];
+		std::size_t i1 = next(i);
+		std::size_t i2 = next(i1);
+		std::size_t i3 = next(i2);
+		Instr *b = inner(i1);
+		if (!b) continue;
+		// dup_1 1, push_scope_object, pop_local_x -> loop_enter_x (start of iteration of the for loop)
+		if (a.cmd == Cmd::dup_1 && a.operand == 1 && b->cmd == Cmd::push_scope_object) {
+			Instr *c = inner(i2);
+			if (c && (c->cmd == Cmd::pop_local_1 || c->cmd == Cmd::pop_local_2)) {
+				a.cmd = c->cmd == Cmd::pop_local_1?Cmd::loop_enter_1:Cmd::loop_enter_2;
+				a.operand = c->operand;
+				a.opsize = c->opsize;
+				remove(i1);remove(i2);
+				changed = true;
+				continue;
+			}
+		}
+		// scope_to_object, pop_scope, swap, del -> loop_leave (end of iteration of the for loop)
+		if (a.cmd == Cmd::scope_to_object && b->cmd == Cmd::pop_scope) {
+			Instr *c = inner(i2);
+			Instr *d = inner(i3);
+			if (c && d && c->cmd == Cmd::swap && d->cmd == Cmd::del) {
+				setSimple(a, Cmd::loop_leave);
+				remove(i1);remove(i2);remove(i3);
+				changed = true;
+				continue;
+			}
+		}
+		// op_bool_not, jump_false -> jump_true (and vice versa)
+		if (a.cmd == Cmd::op_bool_not && (b->jump == jfJumpFalse || b->jump == jfJumpTrue)) {
+			setJump(a, b->jump == jfJumpFalse?jfJumpTrue:jfJumpFalse, b->target);
+			remove(i1);
+			changed = true;
+			continue;
+		}
+		// push, del -> nothing
+		if (isPurePush(a.cmd) && b->cmd == Cmd::del) {
+			remove(i);
+			remove(i1);
+			changed = true;
+			continue;
+		}
+	}
+	return changed;
+}
+
+bool Optimizer::threadJumps() {
+	bool changed = false;
+	auto n = instrs.size();
+	for (std::size_t i = resolve(0); i < n; i = next(i)) {
+		Instr &x = instrs[i];
+		if (x.jump < 0) continue;
+		std::size_t t = resolve(x.target);
+		//follow chain of unconditional jumps (limited - because it can be infinite loop)
+		for (int guard = 0; guard < 16 && t < n && t != i && instrs[t].jump == jfJump; ++guard) {
+			t = resolve(instrs[t].target);
+		}
+		if (t != x.target) {
+			x.target = t;
+			changed = true;
+		}
+		const JumpFamily &f = jumpFamilies[x.jump];
+		if (f.unconditional) {
+			if (t == next(i)) {
+				remove(i);
+				changed = true;
+			} else if (t == n || instrs[t].cmd == Cmd::exit_block) {
+				setSimple(x, Cmd::exit_block);
+				changed = true;
+			}
+		} else if (t == next(i) && !f.effect) {
+			if (f.consumes) setSimple(x, Cmd::del);
+			else remove(i);
+			changed = true;
+		}
+	}
+	for (auto &sw: switches) {
+		for (auto &target: sw.targets) {
+			std::size_t t = resolve(target);
+			for (int guard = 0; guard < 16 && t < n && instrs[t].jump == jfJump; ++guard) {
+				t = resolve(instrs[t].target);
+			}
+			if (t != target) {
+				target = t;
+				changed = true;
+			}
+		}
+	}
+	return changed;
+}
+
+static Cmd tailCallOf(Cmd cmd) {
+	switch (cmd) {
+		case Cmd::call: return Cmd::tail_call;
+		case Cmd::call_1: return Cmd::tail_call_1;
+		case Cmd::call_2: return Cmd::tail_call_2;
+		case Cmd::mcall_1: return Cmd::tail_mcall_1;
+		case Cmd::mcall_2: return Cmd::tail_mcall_2;
+		default: return Cmd::noop;
+	}
+}
+
+void Optimizer::markTailCalls() {
+	auto n = instrs.size();
+	for (std::size_t i = resolve(0); i < n; i = next(i)) {
+		Instr &x = instrs[i];
+		Cmd tc = tailCallOf(x.cmd);
+		if (tc == Cmd::noop) continue;
+		//call is in tail position, when the block ends right after it
+		std::size_t t = next(i);
+		for (int guard = 0; guard < 16 && t < n && instrs[t].jump == jfJump; ++guard) {
+			t = resolve(instrs[t].target);
+		}
+		if (t == n || instrs[t].cmd == Cmd::exit_block) x.cmd = tc;
+	}
+}
+
+void Optimizer::optimize() {
+	bool changed = true;
+	for (int pass = 0; changed && pass < 16; ++pass) {
+		changed = removeNoops();
+		changed = fuse() || changed;
+		changed = threadJumps() || changed;
+	}
+	markTailCalls();
+}
+
+bool Optimizer::store(Block &block) {
+	auto n = instrs.size();
+	std::vector<std::size_t> newPos(n+1);
+	for (auto &x: instrs) {
+		if (x.jump >= 0) x.opsize = 1;
+	}
+	//relaxation - start with short jumps and extend jumps which don't fit
+	bool grow = true;
+	while (grow) {
+		grow = false;
+		std::size_t pos = 0;
+		for (std::size_t i = 0; i < n; i++) {
+			newPos[i] = pos;
+			if (!instrs[i].removed) pos += 1 + instrs[i].opsize;
+		}
+		newPos[n] = pos;
+		for (std::size_t i = 0; i < n; i++) {
+			Instr &x = instrs[i];
+			if (x.removed || x.jump < 0) continue;
+			x.operand = static_cast<std::int64_t>(newPos[x.target]) - static_cast<std::int64_t>(newPos[i] + 1 + x.opsize);
+			if (!fitsOperand(x.operand, x.opsize)) {
+				if (x.opsize >= 2) return false;
+				x.opsize = 2;
+				grow = true;
+			}
+		}
+	}
+	std::vector<std::uint8_t> code;
+	code.reserve(newPos[n]);
+	for (const auto &x: instrs) {
+		if (x.removed) continue;
+		Cmd cmd = x.cmd;
+		if (x.jump >= 0) {
+			const JumpFamily &f = jumpFamilies[x.jump];
+			cmd = x.opsize == 1?f.cmd1:f.cmd2;
+		}
+		code.push_back(static_cast<std::uint8_t>(cmd));
+		for (int i = 0; i < x.opsize; i++) {
+			int shift = 8*(x.opsize - i - 1);
+			code.push_back(static_cast<std::uint8_t>((static_cast<std::uint64_t>(x.operand) >> shift) & 0xFF));
+		}
+	}
+	//tables of switch_table contain absolute positions, so they are created again
+	for (const auto &sw: switches) {
+		const SwitchTable &tbl = getSwitchTableFromValue(block.consts[sw.cindex]);
+		std::vector<std::size_t> targets;
+		for (auto t: sw.targets) targets.push_back(newPos[t]);
+		block.consts[sw.cindex] = packToValue(SwitchTable(tbl.getLabels(), std::move(targets)));
+	}
+	//remap lines, they are ordered backward, so the order is kept
+	for (auto &l: block.lines) {
+		auto iter = std::lower_bound(instrs.begin(), instrs.end(), l.first, [](const Instr &x, std::size_t pos){
+			return x.origPos < pos;
+		});
+		l.first = newPos[std::distance(instrs.begin(), iter)];
+	}
+	block.code = std::move(code);
+	return true;
+}
+
+}
+
+void optimizeBlock(Block &block) {
+	Optimizer opt;
+	if (!opt.load(block)) return;
+	opt.optimize();
+	Block tmp = block;
+	if (opt.store(tmp)) block = std::move(tmp);
+}
+
+}
@@ -0,0 +1,33 @@
+/*
+ * optimizer.h
+ *
+ *  Created on: 18. 10. 2026
+ *      Author: ondra
+ */
+
+#ifndef SRC_MSCRIPT_OPTIMIZER_H_
+#define SRC_MSCRIPT_OPTIMIZER_H_
+
+#include "block.h"
+
+namespace mscript {
+
+///Peephole optimizer of the bytecode
+/**
+ * Runs over already built block. It fuses common sequences of instructions into
+ * superinstructions (entering and leaving iteration of the for loop), merges negation
+ * with following conditional jump, removes noops and pairs which has no effect, and threads jumps
+ * (jump to jump, jump to exit, jump to next instruction). Finally, all jumps are
+ * encoded to the shortest possible form and line map is updated. Tables of switch_table
+ * are rebuilt with new positions of their targets.
+ *
+ * @param block block to optimize. If the code cannot be optimized (it contains unknown
+ * sequences), it is left unchanged
+ */
+void optimizeBlock(Block &block);
+
+}
+
+
+
+#endif /* SRC_MSCRIPT_OPTIMIZER_H_ */
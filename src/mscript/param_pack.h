@@ -23,9 +23,20 @@ class ListIterator;
 class ValueList: private Value {
 public:
 	ValueList(const Value &x):Value(x),islist(x.type() == json::array  && (x.flags() & paramPackValue))  {}
+	///Creates list over a window of values (arguments on the calc stack)
+	/**
+	 * @param window pointer to first value
+	 * @param count count of values
+	 *
+	 * @note the list doesn't own the values, it must not be used after the window is released
+	 */
+	ValueList(const Value *window, std::size_t count):islist(false),window(window),wsize(count) {}
 	Value operator[](std::size_t idx) const {
 		Value x;
-		if (islist) {
+		if (window) {
+			if (idx < wsize) x = window[idx];
+			if (!x.hasValue()) x = nullptr;
+		} else if (islist) {
 			x = Value::operator[](idx);
 			if (!x.hasValue()) x = nullptr;
 		} else {
@@ -34,16 +45,21 @@ public:
 		return x;
 	}
 	std::size_t size() const {
+		if (window) return wsize;
 		if (islist) return Value::size();else return 1;
 	}
 	bool empty() const {
+		if (window) return wsize == 0;
 		if (islist) return Value::empty(); else return false;
 	}
+	bool isCopyOf(const ValueList &other) const {
+		if (window || other.window) return window == other.window && wsize == other.wsize;
+		return Value::isCopyOf(other);
+	}
 
 
 	ListIterator begin() const;
 	ListIterator end() const ;
-	using Value::isCopyOf;
 
 	friend class ListIterator;
 
@@ -52,6 +68,8 @@ public:
 protected:
 	using Value::v;
 	bool islist;
+	const Value *window = nullptr;
+	std::size_t wsize = 0;
 };
 
 
@@ -117,7 +135,7 @@ inline ListIterator ValueList::begin() const {return ListIterator(*this, 0);}
 inline ListIterator ValueList::end() const {return ListIterator(*this, size());}
 
 inline Value ValueList::toValue() const {
-	if (islist) {
+	if (islist || window) {
 		return Value(json::array, begin(), end(), [&](Value x){
 			return x;
 		});
@@ -9,6 +9,7 @@
 #define SRC_MSCRIPT_PARSER_H_
 
 #include "value.h"
+#include "atoms.h"
 #include <imtjson/parser.h>
 #include <imtjson/namedEnum.h>
 
@@ -177,7 +178,7 @@ public:
 						}
 						const Symbol *kw = strKeywords.find(buffer);
 						if (kw) return {*kw};
-						return {Symbol::identifier, buffer};
+						return {Symbol::identifier, Atoms::intern(buffer)};
 					} else if (isdigit(c)) {
 						buffer.clear();
 						buffer.push_back(c);
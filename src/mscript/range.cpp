@@ -7,6 +7,7 @@
 
 #include <imtjson/value.h>
 #include "range.h"
+#include "value.h"
 
 namespace mscript {
 
@@ -32,8 +33,7 @@ bool RangeValue::equal(const json::IValue *other) const  {
 
 
 json::RefCntPtr<const json::IValue> RangeValue::itemAtIndex(std::size_t index) const {
-	json::Value ret(json::Int(base + dir*index));
-	return ret.getHandle();
+	return intValue(base + dir*static_cast<json::Int>(index)).getHandle();
 }
 
 json::Int RangeValue::getBegin() const {
@@ -44,6 +44,10 @@ json::Int RangeValue::getEnd() const {
 	return base + dir*sz;
 }
 
+json::Int RangeValue::getDirection() const {
+	return dir;
+}
+
 
 }
 
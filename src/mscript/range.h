@@ -23,6 +23,8 @@ public:
 	virtual bool equal(const json::IValue *other) const override;
 	json::Int getBegin() const;
 	json::Int getEnd() const;
+	///Returns direction of the range (1 or -1)
+	json::Int getDirection() const;
 	double getMult() const;
 protected:
 	json::Int base, dir;
@@ -7,6 +7,7 @@
 
 
 
+#include "block.h"
 #include "function.h"
 #include "scope.h"
 
@@ -14,33 +15,53 @@ namespace mscript {
 
 
 
-static const std::size_t hashSizes[]={29, 47, 101, 199, 263, 521, 839, 1279, 2207, 3571, 9349, 19937, 60649};
+void Scope::init(Value base){
+	clear();
+	this->base = base;
+}
 
-static std::size_t getNextHashSize(std::size_t cur) {
-	if (cur == 0) return hashSizes[0];
-	for (auto iter = std::begin(hashSizes); iter != std::end(hashSizes);++iter) {
-		if (*iter > cur) return *iter;
+void Scope::clear() {
+	base = Value();
+	if (hashed) {
+		vars.clear();
+		index.clear();
+		hashed = false;
+	} else {
+		for (std::size_t i = 0; i < count; i++) flat[i] = Variable();
 	}
-	return cur*3/2;
+	count = 0;
+	slotOwner = Value();
+	slotBlock = nullptr;
+	slots.clear();
+	classDef = false;
 }
 
+Value *Scope::claimSlots(const Value &owner) {
+	if (!slotOwner.defined()) {
+		slotOwner = owner;
+		slotBlock = &getBlockFromValue(owner);
+		slots.resize(slotBlock->locals.size());
+	} else if (slotOwner.getHandle() != owner.getHandle()) {
+		return nullptr;
+	}
+	return slots.data();
+}
 
-void Scope::init(Value base){
-	this->base = base;
-	items.clear();
-	items.resize(getNextHashSize(0));
-	count = 0;
-	rehash_treshold = items.size()*2/3;
+std::size_t Scope::findSlot(const Key &name) const {
+	if (!slotBlock) return Block::npos;
+	auto slot = slotBlock->findLocal(name);
+	return slot != Block::npos && slots[slot].defined()?slot:Block::npos;
 }
 
+const Value &Scope::slotName(std::size_t slot) const {
+	return slotBlock->locals[slot];
+}
 
 Value Scope::convertToObject() const {
 	json::Object obj(base);
-	for (const auto &x: items) {
-		if (x.has_value()) {
-			obj.set(x->name.getString(), x->value);
-		}
-	}
+	forEach([&](const Value &name, const Value &value) {
+		obj.set(name.getString(), value);
+	});
 	if (isFunction(base)) {
 		return repackFunction(base, obj);
 	} else {
@@ -50,15 +71,31 @@ Value Scope::convertToObject() const {
 
 
 bool Scope::get(const std::string_view &name, Value &out) const {
-	auto pos = findLocation(name);
-	const auto &x = items[pos];
-	if (x.has_value()) {
-		out = x->value;
+	return get(Key(name), out);
+}
+
+bool Scope::get(const Key &name, Value &out) const {
+	if (getOwn(name, out)) return true;
+	out = base[name.name];
+	return out.getKey() == name.name;
+}
+
+bool Scope::getOwn(const Key &name, Value &out) const {
+	auto idx = findIndex(name);
+	if (idx < count) {
+		out = begin()[idx].value;
+		return true;
+	}
+	auto slot = findSlot(name);
+	if (slot != Block::npos) {
+		out = slots[slot];
 		return true;
-	} else {
-		out = base[name];
-		return out.getKey() == name;
 	}
+	return false;
+}
+
+bool Scope::isOwn(const Key &name) const {
+	return findIndex(name) < count || findSlot(name) != Block::npos;
 }
 
 
@@ -66,44 +103,74 @@ bool Scope::set(const std::string_view &name, const Value &v) {
 	return set(Value(name),v);
 }
 
-
 bool Scope::set(const Value &name, const Value &v) {
-	auto pos = findLocation(name.getString());
-	auto &x = items[pos];
-	if (x.has_value()) return false;
-	x = Variable{name, v};
-	count++;
-	if (count > rehash_treshold) {
-		std::vector<VarItem> old;
-		old.resize(getNextHashSize(items.size()));
-		std::swap(old, items);
-		rehash_treshold = items.size()*2/3;
-		for (auto &v :  old) {
-			if (v.has_value()) {
-				pos = findLocation(v->name.getString());
-				items[pos] = std::move(v);
-			}
+	return set(name, Atoms::hash(name.getString()), v);
+}
+
+bool Scope::set(const Value &name, std::size_t hash, const Value &v) {
+	Key key(name, hash);
+	if (findSlot(key) != Block::npos) return false;
+	if (!hashed) {
+		for (std::size_t i = 0; i < count; i++) {
+			if (match(flat[i], key)) return false;
+		}
+		if (count < flatSize) {
+			flat[count] = Variable{name, v, hash};
+			count++;
+			return true;
 		}
+		promote();
 	}
+	auto pos = findLocation(key);
+	if (index[pos]) return false;
+	vars.push_back(Variable{name, v, hash});
+	index[pos] = static_cast<std::uint32_t>(vars.size());
+	count++;
+	if (count * 3 > index.size() * 2) rehash(index.size()*2);
 	return true;
 }
 
-std::size_t Scope::findLocation(const std::string_view &name) const {
-	std::size_t sz = items.size();
-	std::hash<std::string_view> h;
-	auto hash = h(name);
-	std::size_t pos = hash%sz;
-	while (items[pos].has_value() && items[pos]->name.getString() != name) {
-		pos = (pos + 1) % sz;
+void Scope::promote() {
+	vars.reserve(flatSize*2);
+	for (std::size_t i = 0; i < count; i++) {
+		vars.push_back(std::move(flat[i]));
+		flat[i] = Variable();
 	}
-	return pos;
+	hashed = true;
+	rehash(flatSize*4);
 }
 
+void Scope::rehash(std::size_t size) {
+	index.clear();
+	index.resize(size, 0);
+	std::size_t mask = size-1;
+	//names are unique, so only free location is searched
+	for (std::size_t i = 0; i < vars.size(); i++) {
+		std::size_t pos = vars[i].hash & mask;
+		while (index[pos]) pos = (pos + 1) & mask;
+		index[pos] = static_cast<std::uint32_t>(i+1);
+	}
+}
 
-std::vector<Scope::VarItem>::const_iterator Scope::find(const std::string_view &key) const {
-	auto loc = findLocation(key);
-	const auto &x = items[loc];
-	if (x.has_value()) return items.begin()+loc;
-	else return items.end();
+std::size_t Scope::findLocation(const Key &name) const {
+	std::size_t mask = index.size()-1;
+	std::size_t pos = name.hash & mask;
+	while (index[pos] && !match(vars[index[pos]-1], name)) {
+		pos = (pos + 1) & mask;
+	}
+	return pos;
 }
+
+std::size_t Scope::findIndex(const Key &name) const {
+	if (hashed) {
+		auto pos = findLocation(name);
+		return index[pos]?index[pos]-1:count;
+	} else {
+		for (std::size_t i = 0; i < count; i++) {
+			if (match(flat[i], name)) return i;
+		}
+		return count;
+	}
+}
+
 }
@@ -8,43 +8,155 @@
 #ifndef SRC_MSCRIPT_SCOPE_H_
 #define SRC_MSCRIPT_SCOPE_H_
 
-#include <optional>
+#include <cstdint>
+#include "atoms.h"
 #include "value.h"
 
 namespace mscript {
 
+struct Block;
 
 class Scope {
 public:
+	///Count of variables stored in the flat array, above this count, the hash table is used
+	static constexpr std::size_t flatSize = 8;
+
+	///Initializes the scope
+	/**
+	 * Scope can be reused, the storage allocated by previous use is kept
+	 * @param base base object
+	 */
 	void init(Value base);
+	///Releases all values, but keeps allocated storage for next use
+	void clear();
 	Value getBase() const {return base;}
 
 	Value convertToObject() const;
 
+	///Name of variable with precomputed hash
+	struct Key {
+		///name of variable
+		std::string_view name;
+		///hash of the name (see Atoms::hash)
+		std::size_t hash;
+		///handle of the name, if it is known. Interned names are compared by this pointer
+		const json::IValue *handle;
+
+		explicit Key(const std::string_view &name):name(name),hash(Atoms::hash(name)),handle(nullptr) {}
+		explicit Key(const Value &name):Key(name, Atoms::hash(name.getString())) {}
+		Key(const Value &name, std::size_t hash):name(name.getString()),hash(hash),handle(name.getHandle().get()) {}
+	};
+
 	bool set(const Value &name, const Value &v);
 	bool set(const std::string_view &name, const Value &v);
+	///Sets variable, hash of the name is already known
+	bool set(const Value &name, std::size_t hash, const Value &v);
 	bool get(const std::string_view &name, Value &out) const;
+	bool get(const Key &name, Value &out) const;
+	///Retrieves variable defined in this scope (base object is not searched)
+	/**
+	 * @param name name of variable
+	 * @param out value of variable
+	 * @retval true found
+	 * @retval false not defined in this scope
+	 */
+	bool getOwn(const Key &name, Value &out) const;
+	///Determines whether variable is defined in this scope (base object is not searched)
+	bool isOwn(const Key &name) const;
+	///Determines whether variable is stored by name (not in a slot) in this scope
+	bool isNamed(const Key &name) const {return count && findIndex(name) < count;}
+
+	///Calls function for each variable defined in this scope
+	/**
+	 * @param fn function receives (const Value &name, const Value &value). Variables
+	 * stored by name are visited in the order of their definition, then local variables
+	 * stored in slots
+	 */
+	template<typename Fn>
+	void forEach(Fn &&fn) const;
+
+	///Retrieves slots of local variables if the scope is owned by given block
+	/**
+	 * @param owner block which owns the slots
+	 * @return pointer to slots, or nullptr if the scope is not owned by the block
+	 */
+	const Value *getSlots(const Value &owner) const {
+		return slotOwner.getHandle() == owner.getHandle()?slots.data():nullptr;
+	}
+	///Retrieves slots of local variables for writing.
+	/**
+	 * If the scope is not owned yet, it is claimed by the block. Slots are the only
+	 * storage of the local variables, their names are resolved through the block
+	 * (see Block::findLocal)
+	 *
+	 * @param owner block which owns the slots
+	 * @return pointer to slots, or nullptr if the scope is owned by other block
+	 */
+	Value *claimSlots(const Value &owner);
+
+	///Marks scope, that it defines a type class (Array, String, etc)
+	void markClassDef() {classDef = true;}
+	///Returns true, if the scope defines a type class
+	bool isClassDef() const {return classDef;}
+protected:
 
 	struct Variable {
 		json::Value name;
 		json::Value value;
+		///hash of the name
+		std::size_t hash = 0;
 	};
 
-
-	using VarItem = std::optional<Variable>;
-
-	auto begin() const {return items.begin();}
-	auto end() const {return items.end();}
-	std::vector<VarItem>::const_iterator find(const std::string_view &key) const;
-protected:
+	const Variable *begin() const {return hashed?vars.data():flat;}
+	const Variable *end() const {return begin()+count;}
 
 	Value base;
-	std::vector<VarItem> items;
-	std::size_t count=0, rehash_treshold=0;
-
-	std::size_t findLocation(const std::string_view &name) const;
+	///variables, while count of variables is below flatSize
+	Variable flat[flatSize];
+	///variables, when hash table is used
+	std::vector<Variable> vars;
+	///hash table - contains index+1 to vars, zero is empty item. Size is power of two
+	std::vector<std::uint32_t> index;
+	///count of variables
+	std::size_t count = 0;
+	///true if hash table is used
+	bool hashed = false;
+	///block which owns slots (slots are valid only for this block)
+	Value slotOwner;
+	///block which owns slots, names of slots are in Block::locals
+	const Block *slotBlock = nullptr;
+	///values of local variables, undefined slot is not assigned
+	std::vector<Value> slots;
+	///scope defines type class
+	bool classDef = false;
+
+	///Finds variable, returns its index or count if not found
+	std::size_t findIndex(const Key &name) const;
+	///Finds location in the hash table for given name
+	std::size_t findLocation(const Key &name) const;
+	///Compares variable with the key
+	static bool match(const Variable &var, const Key &name) {
+		return var.name.getHandle().get() == name.handle
+				|| (var.hash == name.hash && var.name.getString() == name.name);
+	}
+	///Moves variables from the flat array to the hash table
+	void promote();
+	///Rebuilds the hash table with given size
+	void rehash(std::size_t size);
+	///Finds slot of the variable, returns npos if not found or not assigned
+	std::size_t findSlot(const Key &name) const;
+	///Retrieves name of the slot
+	const Value &slotName(std::size_t slot) const;
 };
 
+template<typename Fn>
+inline void Scope::forEach(Fn &&fn) const {
+	for (const auto &x: *this) fn(x.name, x.value);
+	for (std::size_t i = 0; i < slots.size(); i++) {
+		if (slots[i].defined()) fn(slotName(i), slots[i]);
+	}
+}
+
 }
 
 
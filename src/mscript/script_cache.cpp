@@ -0,0 +1,220 @@
+/*
+ * script_cache.cpp
+ *
+ *  Created on: 18. 10. 2026
+ *      Author: ondra
+ */
+
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <thread>
+#include <unistd.h>
+#include "block.h"
+#include "bytecode.h"
+#include "compiler.h"
+#include "exceptions.h"
+#include "script_cache.h"
+
+namespace mscript {
+
+namespace {
+
+///FNV-1a hash
+class Hasher {
+public:
+	void add(std::string_view s) {
+		for (char c: s) {
+			h ^= static_cast<std::uint8_t>(c);
+			h *= 0x100000001B3ULL;
+		}
+	}
+	void add(std::uint64_t v) {
+		for (int i = 0; i < 8; i++) {
+			h ^= static_cast<std::uint8_t>(v >> (i*8));
+			h *= 0x100000001B3ULL;
+		}
+	}
+	std::uint64_t get() const {return h;}
+protected:
+	std::uint64_t h = 0xCBF29CE484222325ULL;
+};
+
+///Creates header of the file: <line> <file> <source>, sizes are stored as 8 bytes (little endian)
+static std::string fileHeader(std::string_view source, const CodeLocation &loc) {
+	std::string out;
+	auto num = [&](std::uint64_t v) {
+		for (int i = 0; i < 8; i++) out.push_back(static_cast<char>(v >> (i*8)));
+	};
+	num(loc.line);
+	num(loc.file.size());
+	out.append(loc.file);
+	num(source.size());
+	out.append(source);
+	return out;
+}
+
+///Creates name of temporary file unique for the process, the thread and the call
+static std::string tempName(const std::string &name) {
+	static std::atomic<unsigned long> counter = 0;
+	char buff[64];
+	std::snprintf(buff, sizeof(buff), ".%ld.%zx.%lu.tmp",
+			static_cast<long>(::getpid()),
+			std::hash<std::thread::id>()(std::this_thread::get_id()),
+			counter.fetch_add(1, std::memory_order_relaxed));
+	return name + buff;
+}
+
+///Estimates memory occupied by the block (including nested blocks)
+static std::size_t estimateSize(const Value &v) {
+	if (!isBlock(v)) return sizeof(Value) + (v.type() == json::string?v.getString().size():0);
+	const Block &b = getBlockFromValue(v);
+	std::size_t sz = sizeof(Block) + b.code.size()
+			+ b.locals.size() * sizeof(Value)
+			+ b.lines.size() * sizeof(b.lines[0]);
+	for (const Value &c: b.consts) sz += estimateSize(c);
+	return sz;
+}
+
+}
+
+ScriptCache::ScriptCache(std::size_t memoryLimit, std::string directory)
+	:memoryLimit(memoryLimit),directory(std::move(directory)) {}
+
+Value ScriptCache::compile(Value globalScope, const CodeLocation &loc, std::string_view source) {
+	Hasher hs;
+	hs.add(source);
+	hs.add(loc.file);
+	hs.add(static_cast<std::uint64_t>(loc.line));
+	Key key{hs.get(), globalScope.getHandle().get()};
+	{
+		std::unique_lock _(mx);
+		auto iter = index.find(key);
+		if (iter != index.end() && matches(*iter->second, source, loc)) {
+			lru.splice(lru.begin(), lru, iter->second);
+			++stats.hits;
+			return iter->second->block;
+		}
+		++stats.misses;
+	}
+	std::string fname;
+	Value block;
+	if (!directory.empty()) {
+		fname = fileName(key.hash, globalScope);
+		block = loadFile(fname, source, loc);
+	}
+	if (block.defined()) {
+		std::unique_lock _(mx);
+		++stats.diskHits;
+	} else {
+		Compiler cmp(globalScope);
+		block = cmp.compileString(loc, source);
+		if (!fname.empty()) storeFile(fname, block, source, loc);
+	}
+	std::unique_lock _(mx);
+	insert(key, globalScope, block, source, loc);
+	return block;
+}
+
+void ScriptCache::insert(const Key &key, Value scope, Value block, std::string_view source, const CodeLocation &loc) {
+	auto iter = index.find(key);
+	if (iter != index.end()) {
+		if (matches(*iter->second, source, loc)) {
+			//compiled concurrently by other thread
+			lru.splice(lru.begin(), lru, iter->second);
+			return;
+		}
+		//collision of hashes, the newer script replaces the older one
+		stats.memoryUsage -= iter->second->size;
+		lru.erase(iter->second);
+		index.erase(iter);
+	}
+	std::size_t sz = estimateSize(block) + source.size() + loc.file.size();
+	if (sz > memoryLimit) {
+		stats.entries = lru.size();
+		return;
+	}
+	lru.push_front({key, scope, block, sz, std::string(source), loc});
+	index.emplace(key, lru.begin());
+	stats.memoryUsage += sz;
+	while (stats.memoryUsage > memoryLimit) {
+		const Entry &e = lru.back();
+		stats.memoryUsage -= e.size;
+		index.erase(e.key);
+		lru.pop_back();
+	}
+	stats.entries = lru.size();
+}
+
+void ScriptCache::clear() {
+	std::unique_lock _(mx);
+	index.clear();
+	lru.clear();
+	stats.entries = 0;
+	stats.memoryUsage = 0;
+}
+
+ScriptCache::Stats ScriptCache::getStats() const {
+	std::unique_lock _(mx);
+	return stats;
+}
+
+std::string ScriptCache::fileName(std::uint64_t srcHash, const Value &globalScope) const {
+	Hasher hs;
+	hs.add(srcHash);
+	//values are included, because they can be baked into the block during compilation
+	for (Value v: globalScope) {
+		hs.add(v.getKey());
+		hs.add(static_cast<std::uint64_t>(v.type()));
+		hs.add(v.stringify().str());
+	}
+	char buff[17];
+	std::snprintf(buff, sizeof(buff), "%016llx", static_cast<unsigned long long>(hs.get()));
+	std::string out = directory;
+	if (out.back() != '/') out.push_back('/');
+	out.append(buff);
+	out.append(".mscb");
+	return out;
+}
+
+Value ScriptCache::loadFile(const std::string &name, std::string_view source, const CodeLocation &loc) {
+	std::ifstream f(name, std::ios::in|std::ios::binary);
+	if (!f) return Value();
+	std::string data((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+	//file starts with the header, it must match the compiled script
+	std::string hdr = fileHeader(source, loc);
+	if (data.compare(0, hdr.size(), hdr) != 0) return Value();
+	try {
+		return loadBlock(std::string_view(data).substr(hdr.size()));
+	} catch (const BuildError &) {
+		//damaged or incompatible file, it will be replaced
+		return Value();
+	}
+}
+
+void ScriptCache::storeFile(const std::string &name, const Value &block, std::string_view source, const CodeLocation &loc) {
+	std::string data = fileHeader(source, loc);
+	try {
+		data.append(saveBlock(block));
+	} catch (const BuildError &) {
+		//block contains native values, it cannot be stored
+		return;
+	}
+	//other threads or processes can store the same file at the same time
+	std::string tmp = tempName(name);
+	{
+		std::ofstream f(tmp, std::ios::out|std::ios::binary|std::ios::trunc);
+		if (!f) return;
+		f.write(data.data(), data.size());
+		if (!f) {
+			f.close();
+			std::remove(tmp.c_str());
+			return;
+		}
+	}
+	if (std::rename(tmp.c_str(), name.c_str())) std::remove(tmp.c_str());
+}
+
+}
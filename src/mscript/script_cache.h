@@ -0,0 +1,128 @@
+/*
+ * script_cache.h
+ *
+ *  Created on: 18. 10. 2026
+ *      Author: ondra
+ */
+
+#ifndef SRC_MSCRIPT_SCRIPT_CACHE_H_
+#define SRC_MSCRIPT_SCRIPT_CACHE_H_
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include "codelocation.h"
+#include "value.h"
+
+namespace mscript {
+
+///Cache of compiled scripts
+/**
+ * Scripts are addressed by content - by hash of the source text, the code location
+ * and identity of the global scope (which is used during compilation to evaluate
+ * constant expressions). When the same script is compiled again, existing compiled
+ * block is returned. The source text and the location are stored with the block and
+ * compared, so a collision of hashes cannot return a different script.
+ *
+ * Count of cached blocks is limited by estimated memory usage. Least recently used
+ * blocks are removed first. Optionally, compiled blocks can be also stored to a
+ * directory (see saveBlock), so they survive restart of the application. Because
+ * identity of the global scope cannot be stored, the files are addressed by content of
+ * the global scope instead (names and values of global variables, native values are
+ * represented by their description). The file also contains the source text and the
+ * location, which are compared when the file is loaded.
+ *
+ * The object is MT safe
+ */
+class ScriptCache {
+public:
+
+	///Statistics
+	struct Stats {
+		///count of requests satisfied from the memory
+		std::size_t hits = 0;
+		///count of requests not found in the memory
+		std::size_t misses = 0;
+		///count of misses satisfied from the directory
+		std::size_t diskHits = 0;
+		///count of blocks in the memory
+		std::size_t entries = 0;
+		///estimated memory used by blocks in the memory
+		std::size_t memoryUsage = 0;
+	};
+
+	///Construct the cache
+	/**
+	 * @param memoryLimit maximum estimated memory used by cached blocks
+	 * @param directory optional directory, where compiled blocks are stored. Empty
+	 * string disables storing. The directory must exist
+	 */
+	ScriptCache(std::size_t memoryLimit = 16*1024*1024, std::string directory = std::string());
+
+	///Compile the script or return cached block
+	/**
+	 * @param globalScope global scope used for compilation
+	 * @param loc code location
+	 * @param source source text
+	 * @return compiled block
+	 * @exception CompileError compilation failed (failures are not cached)
+	 */
+	Value compile(Value globalScope, const CodeLocation &loc, std::string_view source);
+
+	///Remove all blocks from the memory (directory is not affected)
+	void clear();
+
+	///Retrieve statistics
+	Stats getStats() const;
+
+
+protected:
+
+	struct Key {
+		std::uint64_t hash;
+		const json::IValue *scope;
+		bool operator==(const Key &other) const {
+			return hash == other.hash && scope == other.scope;
+		}
+	};
+
+	struct KeyHash {
+		std::size_t operator()(const Key &k) const {
+			return static_cast<std::size_t>(k.hash ^ (reinterpret_cast<std::uintptr_t>(k.scope) * 0x9E3779B97F4A7C15ULL));
+		}
+	};
+
+	struct Entry {
+		Key key;
+		///holds global scope, so its identity cannot be reused
+		Value scope;
+		Value block;
+		std::size_t size;
+		///source text and location, they are compared on a hit
+		std::string source;
+		CodeLocation loc;
+	};
+
+	using LRU = std::list<Entry>;
+
+	std::size_t memoryLimit;
+	std::string directory;
+	mutable std::mutex mx;
+	LRU lru;
+	std::unordered_map<Key, LRU::iterator, KeyHash> index;
+	Stats stats;
+
+	void insert(const Key &key, Value scope, Value block, std::string_view source, const CodeLocation &loc);
+	Value loadFile(const std::string &name, std::string_view source, const CodeLocation &loc);
+	void storeFile(const std::string &name, const Value &block, std::string_view source, const CodeLocation &loc);
+	static bool matches(const Entry &e, std::string_view source, const CodeLocation &loc) {
+		return e.source == source && e.loc.file == loc.file && e.loc.line == loc.line;
+	}
+	std::string fileName(std::uint64_t srcHash, const Value &globalScope) const;
+};
+
+}
+
+#endif /* SRC_MSCRIPT_SCRIPT_CACHE_H_ */
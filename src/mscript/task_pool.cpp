@@ -0,0 +1,85 @@
+/*
+ * task_pool.cpp
+ *
+ *  Created on: 18. 10. 2026
+ *      Author: ondra
+ */
+
+#include <new>
+#include "task_pool.h"
+
+namespace mscript {
+
+namespace {
+
+struct FreeBlock {
+	FreeBlock *next;
+};
+
+static constexpr std::size_t sizeClasses = TaskPool::maxSize/TaskPool::granularity;
+
+struct PoolState {
+	FreeBlock *lists[sizeClasses] = {};
+	std::size_t counts[sizeClasses] = {};
+	TaskPool::Stats stats;
+
+	~PoolState();
+};
+
+thread_local PoolState pool;
+///set when pool is destroyed (thread exits), then memory is released directly
+thread_local bool poolDestroyed = false;
+
+PoolState::~PoolState() {
+	for (FreeBlock *&l: lists) {
+		while (l) {
+			FreeBlock *n = l->next;
+			::operator delete(l);
+			l = n;
+		}
+	}
+	poolDestroyed = true;
+}
+
+}
+
+void *TaskPool::alloc(std::size_t sz) {
+	if (sz == 0 || sz > maxSize || poolDestroyed) {
+		if (!poolDestroyed) ++pool.stats.allocations;
+		return ::operator new(sz);
+	}
+	std::size_t idx = (sz - 1)/granularity;
+	FreeBlock *b = pool.lists[idx];
+	if (b) {
+		pool.lists[idx] = b->next;
+		--pool.counts[idx];
+		++pool.stats.reuses;
+		return b;
+	}
+	++pool.stats.allocations;
+	return ::operator new((idx+1)*granularity);
+}
+
+void TaskPool::dealloc(void *ptr, std::size_t sz) {
+	if (!ptr) return;
+	if (sz == 0 || sz > maxSize || poolDestroyed) {
+		::operator delete(ptr);
+		return;
+	}
+	std::size_t idx = (sz - 1)/granularity;
+	if (pool.counts[idx] >= maxFree) {
+		::operator delete(ptr);
+		return;
+	}
+	FreeBlock *b = reinterpret_cast<FreeBlock *>(ptr);
+	b->next = pool.lists[idx];
+	pool.lists[idx] = b;
+	++pool.counts[idx];
+}
+
+TaskPool::Stats TaskPool::getStats() {
+	if (poolDestroyed) return {};
+	return pool.stats;
+}
+
+}
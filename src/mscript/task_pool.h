@@ -0,0 +1,55 @@
+/*
+ * task_pool.h
+ *
+ *  Created on: 18. 10. 2026
+ *      Author: ondra
+ */
+
+#ifndef SRC_MSCRIPT_TASK_POOL_H_
+#define SRC_MSCRIPT_TASK_POOL_H_
+
+#include <cstddef>
+
+namespace mscript {
+
+///Pool of memory for task objects (see AbstractTask)
+/**
+ * Tasks are created and destroyed very often (every call of a function). Released
+ * memory is kept in free lists by size, so next task of similar size reuses it without
+ * calling the allocator. The pool is per thread, so it is effectively shared by virtual
+ * machines running on the same thread. Memory released by other thread is stored
+ * to the pool of that thread.
+ */
+class TaskPool {
+public:
+
+	///Statistics of the pool
+	struct Stats {
+		///count of allocations passed to the allocator
+		std::size_t allocations = 0;
+		///count of allocations satisfied from the pool
+		std::size_t reuses = 0;
+	};
+
+	///Allocate memory for a task
+	static void *alloc(std::size_t sz);
+	///Release memory of a task
+	/**
+	 * @param ptr pointer to memory
+	 * @param sz size of the memory (same as passed to alloc)
+	 */
+	static void dealloc(void *ptr, std::size_t sz);
+	///Retrieves statistics of the pool of the current thread
+	static Stats getStats();
+
+	///size classes are multiplies of this value
+	static constexpr std::size_t granularity = 16;
+	///larger tasks are not pooled
+	static constexpr std::size_t maxSize = 512;
+	///max count of free blocks of each size class
+	static constexpr std::size_t maxFree = 64;
+};
+
+}
+
+#endif /* SRC_MSCRIPT_TASK_POOL_H_ */
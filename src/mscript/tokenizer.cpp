@@ -0,0 +1,204 @@
+/*
+ * tokenizer.cpp
+ *
+ *  Created on: 18. 10. 2026
+ *      Author: ondra
+ */
+
+#include <cctype>
+#include <system_error>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "atoms.h"
+#include "tokenizer.h"
+
+namespace mscript {
+
+Token Tokenizer::readToken() {
+	while (true) {
+		while (peek() == ' ' || peek() == '\t') pos++;
+		std::size_t from = pos;
+		int c = get();
+		switch (c) {
+			case -1: return {Symbol::eof};
+			case '\n': return {Symbol::separator};
+			case '\r': accept('\n'); return {Symbol::separator};
+			case '!': return {accept('=')?Symbol::s_not_equal:Symbol::s_exclamation};
+			case '?': if (accept('=')) return {Symbol::s_qequal};
+					  if (accept('?')) return {Symbol::s_dblq};
+					  return {Symbol::s_questionmark};
+			case '%': return {Symbol::s_percent};
+			case '^': return {Symbol::s_power};
+			case '(': return {Symbol::s_left_bracket};
+			case ')': return {Symbol::s_right_bracket};
+			case '*': return {Symbol::s_star};
+			case '/': return {Symbol::s_slash};
+			case '+': return {Symbol::s_plus};
+			case '-': return {accept('>')?Symbol::s_cast:Symbol::s_minus};
+			case '@': return {Symbol::s_amp};
+			case '$': return {Symbol::s_dollar};
+			case '>': return {accept('=')?Symbol::s_greater_equal:Symbol::s_greater};
+			case '<': if (accept('=')) return {Symbol::s_less_equal};
+					  if (accept('>')) return {Symbol::s_not_equal};
+					  return {Symbol::s_less};
+			case '=': if (accept('=')) return {Symbol::s_dequal};
+					  if (accept('>')) return {Symbol::s_arrow};
+					  return {Symbol::s_equal};
+			case '.': if (accept('.')) return {accept('.')?Symbol::s_threedots:Symbol::s_twodots};
+					  return {Symbol::s_dot};
+			case ';': return {Symbol::s_semicolon};
+			case ':': return {Symbol::s_doublecolon};
+			case ',': return {Symbol::s_comma};
+			case '[': return {Symbol::s_left_square_bracket};
+			case ']': return {Symbol::s_right_square_bracket};
+			case '{': return {Symbol::s_left_brace};
+			case '}': return {Symbol::s_right_brace};
+			case '"': {
+				from = pos;
+				c = get();
+				while (c != '"') {
+					if (c == -1) throw json::ParseError("Unterminated string", c);
+					if (c == '\\') get();
+					c = get();
+				}
+				return {Symbol::string, text.substr(from, pos - from - 1)};
+			}
+			case '#':  //remove comments
+				c = peek();
+				while (c != '\r' && c != '\n' && c != -1) {
+					pos++;
+					c = peek();
+				}
+				break;
+			default:
+				if (isalpha(c) || c == '_') {
+					while (isalnum(peek()) || peek() == '_') pos++;
+					return span(Symbol::identifier, from);
+				} else if (isdigit(c)) {
+					while (isdigit(peek())) pos++;
+					return span(Symbol::number, from);
+				} else {
+					throw json::ParseError("Unknown symbol", c);
+				}
+		}
+	}
+}
+
+Element Tokenizer::readNext() {
+	Token t = readToken();
+	switch (t.symbol) {
+		case Symbol::identifier: return intern(t.text);
+		case Symbol::number: return {Symbol::number, Value(t.text)};
+		case Symbol::string: return {Symbol::string, unescape(t.text)};
+		default: return {t.symbol};
+	}
+}
+
+const Element &Tokenizer::intern(std::string_view word) {
+	auto iter = words.find(word);
+	if (iter == words.end()) {
+		//keywords are resolved once for each unique word
+		const Symbol *kw = strKeywords.find(std::string(word));
+		Element el = kw?Element{*kw}:Element{Symbol::identifier, Atoms::intern(word)};
+		iter = words.emplace(word, std::move(el)).first;
+	}
+	return iter->second;
+}
+
+static int hexDigit(int c) {
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	throw json::ParseError("Invalid escape sequence", c);
+}
+
+static void appendUtf8(std::string &out, unsigned int cp) {
+	if (cp < 0x80) {
+		out.push_back(static_cast<char>(cp));
+	} else if (cp < 0x800) {
+		out.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+		out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+	} else if (cp < 0x10000) {
+		out.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+		out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+		out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+	} else {
+		out.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+		out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+		out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+		out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+	}
+}
+
+Value Tokenizer::unescape(std::string_view str) {
+	auto bs = str.find('\\');
+	//most of strings don't contain escape sequences, so they are created directly from the span
+	if (bs == str.npos) return Value(str);
+	std::string out(str.substr(0, bs));
+	std::size_t p = bs;
+	auto get = [&]()->int {return p < str.size()?static_cast<unsigned char>(str[p++]):-1;};
+	auto hex4 = [&]{
+		unsigned int r = 0;
+		for (int i = 0; i < 4; i++) r = (r << 4) | hexDigit(get());
+		return r;
+	};
+	while (p < str.size()) {
+		int c = get();
+		if (c != '\\') {
+			out.push_back(static_cast<char>(c));
+			continue;
+		}
+		c = get();
+		switch (c) {
+			case '"': out.push_back('"');break;
+			case '\\': out.push_back('\\');break;
+			case '/': out.push_back('/');break;
+			case 'b': out.push_back('\b');break;
+			case 'f': out.push_back('\f');break;
+			case 'n': out.push_back('\n');break;
+			case 'r': out.push_back('\r');break;
+			case 't': out.push_back('\t');break;
+			case 'u': {
+				unsigned int cp = hex4();
+				if (cp >= 0xD800 && cp < 0xDC00 && str.substr(p, 2) == "\\u") {
+					p += 2;
+					unsigned int lo = hex4();
+					cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+				}
+				appendUtf8(out, cp);
+			}break;
+			default: throw json::ParseError("Invalid escape sequence", c);
+		}
+	}
+	return Value(out);
+}
+
+SourceFile::SourceFile(const std::string &fname) {
+	int fd = ::open(fname.c_str(), O_RDONLY);
+	if (fd < 0) throw std::system_error(errno, std::generic_category(), fname);
+	struct stat st;
+	if (::fstat(fd, &st) < 0) {
+		int e = errno;
+		::close(fd);
+		throw std::system_error(e, std::generic_category(), fname);
+	}
+	size = static_cast<std::size_t>(st.st_size);
+	if (size) {
+		void *p = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p == MAP_FAILED) {
+			int e = errno;
+			::close(fd);
+			throw std::system_error(e, std::generic_category(), fname);
+		}
+		data = static_cast<const char *>(p);
+	}
+	::close(fd);
+}
+
+SourceFile::~SourceFile() {
+	if (data) ::munmap(const_cast<char *>(data), size);
+}
+
+}
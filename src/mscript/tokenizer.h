@@ -0,0 +1,102 @@
+/*
+ * tokenizer.h
+ *
+ *  Created on: 18. 10. 2026
+ *      Author: ondra
+ */
+
+#ifndef SRC_MSCRIPT_TOKENIZER_H_
+#define SRC_MSCRIPT_TOKENIZER_H_
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include "parser.h"
+
+namespace mscript {
+
+///Token read by the tokenizer
+struct Token {
+	///Read symbol class
+	Symbol symbol;
+	///Span of the source text. For strings, it contains text between quotes (without unescaping)
+	std::string_view text;
+};
+
+///Tokenizer which works directly over contiguous buffer
+/**
+ * Unlike the Parser, the tokenizer doesn't copy characters to a temporary buffer. Tokens
+ * reference spans of the source text. Identifiers are interned - each unique name is
+ * looked up in the global table (see Atoms) only once and all its occurrences share
+ * that value (same applies to keywords, which are resolved only once for each unique word).
+ *
+ * The source text must stay valid until the tokenizer is destroyed
+ */
+class Tokenizer {
+public:
+
+	Tokenizer(std::string_view text):text(text) {}
+
+	///Read next token
+	/**
+	 * @return next token, returns Symbol::eof at the end of the text
+	 * @exception json::ParseError unknown symbol or unterminated string
+	 */
+	Token readToken();
+	///Read next element
+	/**
+	 * Converts next token to an element. Identifiers are interned, strings are unescaped
+	 * @return next element, returns Symbol::eof at the end of the text
+	 */
+	Element readNext();
+
+	///Retrieves count of unique identifiers
+	std::size_t getIdentifierCount() const {return words.size();}
+
+protected:
+	std::string_view text;
+	std::size_t pos = 0;
+	///Interned words. Keys reference strings of the stored values (or the source text for keywords)
+	std::unordered_map<std::string_view, Element> words;
+
+	int get() {return pos < text.size()?static_cast<unsigned char>(text[pos++]):-1;}
+	int peek() const {return pos < text.size()?static_cast<unsigned char>(text[pos]):-1;}
+	bool accept(char c) {
+		if (pos < text.size() && text[pos] == c) {pos++;return true;}
+		return false;
+	}
+
+	Token span(Symbol s, std::size_t from) const {return {s, text.substr(from, pos - from)};}
+
+	const Element &intern(std::string_view word);
+	static Value unescape(std::string_view str);
+};
+
+///Maps file to the memory for reading
+/**
+ * Content of the file can be passed to the Tokenizer without copying it
+ */
+class SourceFile {
+public:
+	///Maps the file
+	/**
+	 * @param fname path to the file
+	 * @exception std::system_error file cannot be opened or mapped
+	 */
+	SourceFile(const std::string &fname);
+	~SourceFile();
+
+	SourceFile(const SourceFile &) = delete;
+	SourceFile &operator=(const SourceFile &) = delete;
+
+	///Retrieves content of the file
+	std::string_view getText() const {return std::string_view(data, size);}
+
+protected:
+	const char *data = nullptr;
+	std::size_t size = 0;
+};
+
+}
+
+#endif /* SRC_MSCRIPT_TOKENIZER_H_ */
@@ -5,9 +5,12 @@
  *      Author: ondra
  */
 
+#include <imtjson/object.h>
 #include "block.h"
 #include "function.h"
+#include "range.h"
 #include "value.h"
+#include "vm_memory.h"
 
 namespace mscript {
 
@@ -21,6 +24,67 @@ json::NamedEnum<json::ValueType> strTypeClasses ( {
 		{json::object,"Object"},
 });
 
+bool isTypeClassName(const std::string_view &name) {
+	//all type classes starts with upper case letter
+	if (name.empty() || name[0] < 'A' || name[0] > 'Z') return false;
+	return strTypeClasses.find(name) != nullptr
+			|| name == "Function" || name == "Block" || name == "Native";
+}
+
+//table is created by every thread which uses it, so it is kept small
+static constexpr std::int64_t smallIntMin = -256;
+static constexpr std::int64_t smallIntMax = 1023;
+
+Value intValue(std::int64_t v) {
+	//each thread has own table, so the values are not shared between threads
+	static thread_local const std::vector<Value> smallInts = []{
+		//table is cached, it is not charged to the current virtual machine
+		MemoryMeter::Scope _(nullptr);
+		std::vector<Value> out;
+		out.reserve(smallIntMax-smallIntMin+1);
+		for (std::int64_t i = smallIntMin; i <= smallIntMax; i++) out.push_back(Value(i));
+		return out;
+	}();
+	if (v >= smallIntMin && v <= smallIntMax) return smallInts[v-smallIntMin];
+	else return Value(v);
+}
+
+///Copies items of the container, works for content of native values too
+static Value localizeItems(const Value &v) {
+	if (v.type() == json::object) {
+		json::Object obj;
+		for (Value x: v) obj.set(x.getKey(), localizeValue(x));
+		return obj;
+	} else {
+		return Value(json::array, v.begin(), v.end(), [](const Value &x){return localizeValue(x);});
+	}
+}
+
+Value localizeValue(const Value &v) {
+	//wrapper of the function is recreated, the function itself stays shared
+	if (isFunction(v)) return v.isContainer()?repackFunction(v, localizeItems(v)):v;
+	switch (v.type()) {
+		case json::number:
+			if (v.flags() & json::numberUnsignedInteger) return Value(v.getUIntLong());
+			if (v.flags() & json::numberInteger) return Value(v.getIntLong());
+			return Value(v.getNumber());
+		case json::string:
+			return Value(v.getString());
+		case json::object:
+			if (isNativeType(v)) return v;
+			return localizeItems(v);
+		case json::array: {
+			if (isNativeType(v)) return v;
+			auto rng = dynamic_cast<const RangeValue *>(v.getHandle()->unproxy());
+			if (rng) return newRange(rng->getBegin(), rng->getBegin() + rng->getDirection() * static_cast<json::Int>(rng->size()-1));
+			//other virtual arrays (concatenation, mapping) are materialized
+			return localizeItems(v);
+		}
+		default:
+			return v;
+	}
+}
+
 std::string_view getTypeClass(const Value &val) {
 	if (isNativeType(val)) {
 		if (isFunction(val)) return "Function";
@@ -30,6 +30,33 @@ static inline bool isNativeType(const Value &val) {
 
 std::string_view getTypeClass(const Value &val);
 
+///Determines, whether name is name of a type class (result of getTypeClass)
+bool isTypeClassName(const std::string_view &name);
+
+///Creates integer value
+/**
+ * Small numbers are taken from preallocated table, so no allocation is needed. This
+ * is significant for loops and counters
+ *
+ * @param v number
+ * @return value
+ */
+Value intValue(std::int64_t v);
+
+///Creates private copy of a value
+/**
+ * Objects and arrays are rebuilt (virtual arrays are materialized, ranges are created
+ * again), numbers and strings are created again. Functions
+ * receive new wrapper (the function object is shared, but calls don't copy it). Other
+ * native values (blocks, etc) are kept shared. Copies of the result don't touch reference
+ * counters of the original value (except shared native values), so the result can be used
+ * by a single thread with less contention with other threads, which use the original value.
+ *
+ * @param v value to copy
+ * @return private copy
+ */
+Value localizeValue(const Value &v);
+
 
 
 
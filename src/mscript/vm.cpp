@@ -8,25 +8,28 @@
 #include <imtjson/object.h>
 #include <mscript/exceptions.h>
 #include <mscript/function.h>
+#include "atoms.h"
 #include "vm.h"
 
 namespace mscript {
 
 void VirtualMachine::setGlobalScope(Value globalScope) {
 	this->globalScope = globalScope;
+	++classEpoch;
 }
 
 void VirtualMachine::reset() {
-	scopeStack.clear();
+	release_scopes(0);
+	++classEpoch;
 	run_mode = RunMode::run_reset;
 }
 
-bool VirtualMachine::run() {
+bool VirtualMachine::run_step() {
 	switch (run_mode) {
 	case RunMode::run_fast:return run_fast();
 	case RunMode::run_exception: return run_exception();
 	case RunMode::run_add_task: return run_add_task();
-	case RunMode::run_fast_wtimer: return run_fast_wtimer();
+	case RunMode::run_limited: return run_limited();
 	case RunMode::run_reset: return run_reset();
 	}
 	return false;
@@ -44,6 +47,7 @@ static EmptyTask emptyTask;
 bool VirtualMachine::run_reset() {
 	taskStack.clear();
 	calcStack.clear();
+	pendingArgs = argWindow = noArgWindow;
 	exp = nullptr;
 	curTask = &emptyTask;
 	return run_add_task();
@@ -65,29 +69,63 @@ bool VirtualMachine::run_add_task() {
 		run_mode = RunMode::run_add_task;
 		return false;
 	}
-	if (timeStop.has_value()) {
-		run_mode = RunMode::run_fast_wtimer;
-	} else {
-		run_mode = RunMode::run_fast;
-	}
+	run_mode = has_limits()?RunMode::run_limited:RunMode::run_fast;
 	curTask = taskStack.back().get();
 	return run();
 }
 
-bool VirtualMachine::run_fast_wtimer() {
+bool VirtualMachine::run_limited() {
+	if (steps >= nextCheck) check_limits();
+	return run_fast();
+}
+
+void VirtualMachine::check_limits() {
+	if (fuelStop.has_value() && steps >= *fuelStop) {
+		throw ExecutionLimitReached(LimitType::instructions);
+	}
 	if (timeStop.has_value()) {
 		auto now = std::chrono::system_clock::now();
 		if (now > *timeStop) {
 			throw MaxExecutionTimeReached();
 		}
+		nextCheck = steps + std::max(cfg.clockCheckInterval, 1U);
 	} else {
-		run_mode = RunMode::run_fast;
+		nextCheck = noLimit;
 	}
-	return run_fast();
+	if (fuelStop.has_value()) nextCheck = std::min(nextCheck, *fuelStop);
+	nextCheck = std::min(nextCheck, sliceStop);
+	if (!has_limits()) run_mode = RunMode::run_fast;
+}
+
+void VirtualMachine::update_limits() {
+	nextCheck = steps;
+	if (run_mode == RunMode::run_fast || run_mode == RunMode::run_limited) {
+		run_mode = has_limits()?RunMode::run_limited:RunMode::run_fast;
+	}
+}
+
+VirtualMachine::RunState VirtualMachine::run(std::uint64_t budget) {
+	sliceStop = budget < noLimit - steps?steps + budget:noLimit - 1;
+	update_limits();
+	bool r = true;
+	try {
+		while (r && steps < sliceStop) r = run();
+	} catch (...) {
+		sliceStop = noLimit;
+		update_limits();
+		throw;
+	}
+	sliceStop = noLimit;
+	update_limits();
+	return r?RunState::suspended:RunState::finished;
 }
 
 bool VirtualMachine::run_fast() {
-	if (!curTask->run(*this)) {
+	auto prev = steps;
+	bool r = curTask->run(*this);
+	//tasks which don't report executed instructions (see charge_steps) are counted as one step
+	if (steps == prev) ++steps;
+	if (!r) {
 		taskStack.pop_back();
 		if (taskStack.empty()) {
 			run_mode = RunMode::run_reset; //code exited, next action would be reset
@@ -102,23 +140,32 @@ bool VirtualMachine::run_fast() {
 void VirtualMachine::push_scope(const Value base) {
 	auto sz = scopeStack.size();
 	if (!sz) {
-		scopeStack.emplace_back();
-		scopeStack.back().init(globalScope);
+		alloc_scope().init(globalScope);
 		//if base is not defined, we can bind globalScope to current scope without need to create link
 		if (base.defined()) {
-			scopeStack.emplace_back();
-			scopeStack.back().init(base);
+			alloc_scope().init(base);
 		}
 	} else if (sz >= cfg.maxScopeStack) {
 		throw ExecutionLimitReached(LimitType::scopeStack);
 	} else {
-		if (tmpScopes.empty()) {
-			scopeStack.emplace_back();
-		} else{
-			scopeStack.push_back(std::move(tmpScopes.back()));
-			tmpScopes.pop_back();
+		alloc_scope().init(base);
+	}
+	if (base.defined()) {
+		Scope &scope = scopeStack.back();
+		if (base.type() == json::object) {
+			for (Value x: base) check_class_def(scope, x.getKey());
+		} else {
+			//can't enumerate, expect that anything can be defined
+			scope.markClassDef();
+			++classEpoch;
 		}
-		scopeStack.back().init(base);
+	}
+}
+
+void VirtualMachine::check_class_def(Scope &scope, const std::string_view &name) {
+	if (isTypeClassName(name)) {
+		scope.markClassDef();
+		++classEpoch;
 	}
 }
 
@@ -134,8 +181,12 @@ void VirtualMachine::push_task(std::unique_ptr<AbstractTask>&&task) {
 }
 
 bool VirtualMachine::get_var(const std::string_view &name, Value &value) {
+	return get_var(Scope::Key(name), value);
+}
+
+bool VirtualMachine::get_var(const Scope::Key &name, Value &value) {
 	if (scopeStack.empty()) {
-		value = globalScope[name];
+		value = globalScope[name.name];
 		return value.defined();
 	}
 	auto r = scopeStack.rbegin();
@@ -148,22 +199,58 @@ bool VirtualMachine::get_var(const std::string_view &name, Value &value) {
 	return false;
 }
 
+bool VirtualMachine::get_local(const Value &block, std::size_t depth, std::size_t slot, const Scope::Key &name, Value &value) {
+	auto sz = scopeStack.size();
+	if (depth < sz) {
+		const Value *slots = scopeStack[sz - 1 - depth].getSlots(block);
+		if (slots && slots[slot].defined()) {
+			value = slots[slot];
+			return true;
+		}
+	}
+	return get_var(name, value);
+}
+
+bool VirtualMachine::set_local(const Value &block, std::size_t slot, const Value &name, std::size_t hash, const Value &value) {
+	if (scopeStack.empty()) return false;
+	Scope &scope = scopeStack.back();
+	Value *slots = value.defined()?scope.claimSlots(block):nullptr;
+	if (!slots) return set_var(name, hash, value);
+	if (slots[slot].defined() || scope.isNamed(Scope::Key(name, hash))) return false;
+	slots[slot] = value;
+	check_class_def(scope, name.getString());
+	return true;
+}
+
 bool VirtualMachine::set_var(const std::string_view &name, const Value &value) {
 	if (scopeStack.empty()) return false;
-	return scopeStack.back().set(name, value);
+	Scope &scope = scopeStack.back();
+	if (!scope.set(name, value)) return false;
+	check_class_def(scope, name);
+	return true;
 }
 
 bool VirtualMachine::set_var(const Value &name, const Value &value) {
+	return set_var(name, Atoms::hash(name.getString()), value);
+}
+
+bool VirtualMachine::set_var(const Value &name, std::size_t hash, const Value &value) {
 	if (scopeStack.empty()) return false;
-	return scopeStack.back().set(name, value);
+	Scope &scope = scopeStack.back();
+	if (!scope.set(name, hash, value)) return false;
+	check_class_def(scope, name.getString());
+	return true;
 }
 
 void VirtualMachine::define_param_pack(std::size_t arguments) {
 	collapse_param_pack();
-	auto paramPack = std::min(calcStack.size(),arguments);
-	if (paramPack != 1) {
-		auto newsz = calcStack.size()-paramPack;
-		auto pv = ValueListValue::create(paramPack);
+	pack_arguments(std::min(calcStack.size(),arguments));
+}
+
+void VirtualMachine::pack_arguments(std::size_t count) {
+	if (count != 1) {
+		auto newsz = calcStack.size()-count;
+		auto pv = ValueListValue::create(count);
 		for (auto i = newsz; i < calcStack.size(); i++) {
 			pv->push_back(calcStack[i].getHandle());
 		}
@@ -176,12 +263,44 @@ ValueList VirtualMachine::top_params() const {
 	return ValueList(calcStack.empty()?Value():calcStack.back());
 }
 
+ValueList VirtualMachine::top_args() const {
+	if (argWindow == noArgWindow) return top_params();
+	return ValueList(calcStack.data()+calcStack.size()-argWindow, argWindow);
+}
+
+void VirtualMachine::del_args() {
+	if (argWindow == noArgWindow) {
+		del_value();
+	} else {
+		calcStack.resize(calcStack.size()-argWindow);
+		argWindow = noArgWindow;
+	}
+}
+
+void VirtualMachine::bind_args(const AbstractFunction &fnobj) {
+	if (pendingArgs != noArgWindow) {
+		auto args = pendingArgs;
+		pendingArgs = noArgWindow;
+		if (fnobj.acceptsArgWindow()) argWindow = args;
+		else pack_arguments(args);
+	}
+}
+
+Value VirtualMachine::pop_call_object() {
+	if (pendingArgs == noArgWindow) return pop_value();
+	auto iter = calcStack.end()-pendingArgs-1;
+	Value obj = std::move(*iter);
+	calcStack.erase(iter);
+	return obj;
+}
+
 void VirtualMachine::raise(std::exception_ptr e) {
 	if (e != nullptr) exp = e;
 	run_mode = RunMode::run_exception; //flag VM, we need to run exception handler
 }
 bool VirtualMachine::run_exception() {
 	exp_location.clear();
+	pendingArgs = argWindow = noArgWindow;
 	newTasks.clear(); //in case of exception, clear all new tasks
 	std::size_t p = taskStack.size();
 	while (p) {
@@ -202,10 +321,28 @@ bool VirtualMachine::run_exception() {
 
 bool VirtualMachine::pop_scope() {
 	if (scopeStack.empty()) return false;
-	tmpScopes.push_back(std::move(scopeStack.back()));
-	scopeStack.pop_back();
+	if (scopeStack.back().isClassDef()) ++classEpoch;
+	release_scopes(scopeStack.size()-1);
 	return true;
 }
+
+Scope &VirtualMachine::alloc_scope() {
+	if (tmpScopes.empty()) {
+		scopeStack.emplace_back();
+	} else{
+		scopeStack.push_back(std::move(tmpScopes.back()));
+		tmpScopes.pop_back();
+	}
+	return scopeStack.back();
+}
+
+void VirtualMachine::release_scopes(std::size_t count) {
+	while (scopeStack.size() > count) {
+		scopeStack.back().clear();
+		tmpScopes.push_back(std::move(scopeStack.back()));
+		scopeStack.pop_back();
+	}
+}
 Value VirtualMachine::top_value() const {
 	return calcStack.empty()?Value():ValueList(calcStack.back()).toValue();
 }
@@ -229,8 +366,9 @@ bool VirtualMachine::restore_state(const VMState &st) {
 	if (st.scopes > scopeStack.size() || st.values > calcStack.size()) {
 		return false;
 	}
-	scopeStack.resize(st.scopes, Scope());
+	release_scopes(st.scopes);
 	calcStack.resize(st.values);
+	++classEpoch;
 	if (st.paramPack.has_value()) {
 		for (Value x: *st.paramPack) push_value(x);
 		define_param_pack(st.paramPack->size());
@@ -304,9 +442,11 @@ void VirtualMachine::collapse_param_pack() {
 
 bool VirtualMachine::call_function_raw(Value fnval, Value object) {
 	if (!isFunction(fnval)) {
+		pendingArgs = noArgWindow;
 		throw ArgumentIsNotFunction(fnval);
 	} else {
 		const AbstractFunction &fnobj = getFunction(fnval);
+		bind_args(fnobj);
 		auto sz = newTasks.size();
 		fnobj.call(*this,object,fnval);
 		return sz != newTasks.size();
@@ -320,13 +460,38 @@ std::exception_ptr VirtualMachine::get_exception() const {
 
 void VirtualMachine::setTimeStop(std::chrono::system_clock::time_point timeStop) {
 	this->timeStop = timeStop;
+	update_limits();
 }
 
 void VirtualMachine::clearTimeStop() {
 	timeStop.reset();
+	update_limits();
+}
+
+void VirtualMachine::setFuel(std::uint64_t count) {
+	fuelStop = count < noLimit - steps?steps + count:noLimit - 1;
+	update_limits();
+}
+
+void VirtualMachine::clearFuel() {
+	fuelStop.reset();
+	update_limits();
 }
 
 Value VirtualMachine::exec() {
+	if (cfg.execArena && !arena) {
+		arena = MemoryArena::create(memMeter.get(), cfg.maxArenaSize);
+		Value r;
+		try {
+			//executed outside of run(), so the copy is not allocated from the arena
+			r = localizeValue(exec());
+		} catch (...) {
+			arena.reset();
+			throw;
+		}
+		arena.reset();
+		return r;
+	}
 	do {} while (run());
 	auto e = get_exception();
 	if (e != nullptr) std::rethrow_exception(e);
@@ -341,7 +506,42 @@ Value VirtualMachine::exec(std::unique_ptr<AbstractTask>&& t) {
 	return v;
 }
 
+std::shared_ptr<const std::vector<Value> > VirtualMachine::pin_consts(const Value &owner, const std::vector<Value> &consts) {
+	const json::IValue *key = owner.getHandle().get();
+	//block entered repeatedly (loops, recursion) is found without the lookup
+	if (!pinnedConsts.empty() && pinnedConsts.front().owner.getHandle().get() == key) {
+		return pinnedConsts.front().consts;
+	}
+	auto iter = pinnedIndex.find(key);
+	if (iter != pinnedIndex.end()) {
+		pinnedConsts.splice(pinnedConsts.begin(), pinnedConsts, iter->second);
+		return pinnedConsts.front().consts;
+	}
+	//running blocks hold their constants, so they can be released
+	while (!pinnedConsts.empty() && pinnedConsts.size() >= cfg.maxPinnedBlocks) {
+		pinnedIndex.erase(pinnedConsts.back().owner.getHandle().get());
+		pinnedConsts.pop_back();
+	}
+	//pinned constants outlive the execution, so they are not allocated from the arena
+	MemoryMeter::Scope _(nullptr);
+	auto cp = std::make_shared<std::vector<Value> >();
+	cp->reserve(consts.size());
+	for (const Value &v: consts) {
+		//names are compared by identity (see Scope::Key), so they must stay shared
+		cp->push_back(Atoms::isAtom(v)?v:localizeValue(v));
+	}
+	pinnedConsts.push_front({owner, cp});
+	pinnedIndex.emplace(key, pinnedConsts.begin());
+	return cp;
+}
+
 VirtualMachine::VirtualMachine(const Config &cfg):cfg(cfg) {
+	if (cfg.memoryAccounting || cfg.maxMemory || cfg.execArena) {
+		MemoryMeter::install();
+	}
+	if (cfg.memoryAccounting || cfg.maxMemory) {
+		memMeter = MemoryMeter::create(cfg.maxMemory);
+	}
 }
 
 VirtualMachine::VirtualMachine() {
@@ -355,7 +555,11 @@ void VirtualMachine::push_values(const Value &arra) {
 
 
 void VirtualMachine::begin_list() {
-	static Value emptylist (json::PValue::staticCast(ValueListValue::create(0)));
+	static Value emptylist = []{
+		//shared by all executions, so it is not allocated from the arena, nor charged to the meter
+		MemoryMeter::Scope _(nullptr);
+		return Value(json::PValue::staticCast(ValueListValue::create(0)));
+	}();
 	push_value(emptylist);
 }
 
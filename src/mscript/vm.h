@@ -7,8 +7,12 @@
 
 #ifndef SRC_MSCRIPT_VM_H_
 #define SRC_MSCRIPT_VM_H_
+#include <algorithm>
 #include <memory>
 #include <chrono>
+#include <list>
+#include <optional>
+#include <unordered_map>
 #include <imtjson/object.h>
 #include <imtjson/value.h>
 #include <shared/refcnt.h>
@@ -16,6 +20,8 @@
 #include "value.h"
 #include "codelocation.h"
 #include "scope.h"
+#include "vm_memory.h"
+#include "task_pool.h"
 #include "param_pack.h"
 
 namespace mscript {
@@ -24,6 +30,7 @@ namespace mscript {
 
 class VirtualMachine;
 class VMException;
+class AbstractFunction;
 
 
 
@@ -33,6 +40,11 @@ public:
 
 	virtual ~AbstractTask() {}
 
+	///Tasks are allocated from the TaskPool
+	static void *operator new(std::size_t sz) {return TaskPool::alloc(sz);}
+	///Tasks are allocated from the TaskPool
+	static void operator delete(void *ptr, std::size_t sz) {TaskPool::dealloc(ptr, sz);}
+
 	///Inicializes task
 	/**
 	 * Task should prepare virtual machine to run
@@ -100,6 +112,56 @@ public:
 		unsigned int maxTaskStack = 1000;
 		///max scope stack (max scope recursion)
 		unsigned int maxScopeStack = 1000;
+		///max count of instructions executed by a single task's run() without returning to the VM
+		/**
+		 * Tasks which are able to execute multiple instructions in a row (BlockExecution)
+		 * stops after this count of instructions to allow VM to check timers and other
+		 * conditions. Set to 1 to execute single instruction per step (for debugging)
+		 */
+		unsigned int batchSize = 1000;
+		///use threaded dispatch (pre-decoded handlers) when available, otherwise switch dispatch is used
+		bool threadedDispatch = true;
+		///use private copies of constants of blocks (see pin_consts)
+		/**
+		 * Useful when compiled blocks are shared by multiple virtual machines running
+		 * in different threads. Copying of constants doesn't touch reference counters
+		 * shared with other threads.
+		 */
+		bool pinConstants = false;
+		///max count of blocks with pinned constants, when reached, constants of the least recently used block are released
+		unsigned int maxPinnedBlocks = 256;
+		///count of steps between two checks of the time stop
+		/**
+		 * The clock is sampled only once per this count of steps, so the time stop
+		 * can be exceeded by time needed to execute these steps
+		 */
+		unsigned int clockCheckInterval = 16384;
+		///enables accounting of memory allocated by JSON values created by the virtual machine
+		/**
+		 * Accounting requires the accounting allocator, the constructor of the virtual
+		 * machine installs it (see MemoryMeter::install())
+		 */
+		bool memoryAccounting = false;
+		///max memory in bytes allocated by JSON values created by the virtual machine
+		/**
+		 * When allocation exceeds the limit, ExecutionLimitReached is thrown. Set 0 to
+		 * unlimited. Nonzero value enables memory accounting (see memoryAccounting).
+		 *
+		 * The limit is enforced by the accounting allocator of the imtjson library, which
+		 * is installed by the constructor of the virtual machine (see MemoryMeter::install()).
+		 * The allocator is global, so all JSON values created since then carry a small header
+		 */
+		std::size_t maxMemory = 0;
+		///allocate values created during exec() from an arena
+		/**
+		 * The arena is released at once, when exec() returns. Result of exec() is copied
+		 * out of the arena (see localizeValue). Values which escape in other way keep
+		 * the arena alive until they are released. The accounting allocator is installed
+		 * by the constructor of the virtual machine (see MemoryMeter::install())
+		 */
+		bool execArena = false;
+		///max size of the arena, when reached, values are allocated by the standard allocator
+		std::size_t maxArenaSize = 64*1024*1024;
 
 	};
 
@@ -125,7 +187,60 @@ public:
 
 	void reset();
 	///run virtual machine for single step
-	bool run();
+	bool run() {
+		if (memMeter || arena) {
+			MemoryMeter::Scope _(memMeter.get(), arena.get());
+			return run_step();
+		}
+		return run_step();
+	}
+
+	///Result of run() with budget
+	enum class RunState {
+		///execution finished, result or exception is available
+		finished,
+		///budget exhausted, next call of run() continues in execution
+		suspended
+	};
+
+	///run virtual machine until the code finishes or the budget is exhausted
+	/**
+	 * Allows to interleave execution of multiple virtual machines by a scheduler
+	 *
+	 * @param budget max count of steps (see getStepCount). The budget can be slightly
+	 * exceeded, because native tasks are not interrupted in the middle of a step
+	 * @return state of execution
+	 */
+	RunState run(std::uint64_t budget);
+	///Determines, whether current task can continue in execution without returning to the VM
+	/**
+	 * @retval true current task can continue
+	 * @retval false current task must return from the run(), because a new task has been pushed,
+	 * an exception has been raised, or the machine was reset
+	 */
+	bool can_continue() const {
+		return run_mode == RunMode::run_fast || run_mode == RunMode::run_limited;
+	}
+	///Retrieves max count of instructions, which can be executed by a task in a single step
+	/**
+	 * It is Config::batchSize reduced when a limit (time stop, fuel, budget) needs to be
+	 * checked sooner. It is always at least 1
+	 */
+	unsigned int get_batch_size() const {
+		if (run_mode != RunMode::run_limited) return cfg.batchSize;
+		std::uint64_t rm = nextCheck > steps?nextCheck - steps:1;
+		return static_cast<unsigned int>(std::min<std::uint64_t>(cfg.batchSize, rm));
+	}
+	///Accounts instructions executed by the current task
+	/**
+	 * Tasks which execute multiple instructions in a single step (BlockExecution) reports
+	 * count of executed instructions, so they are counted to the step count. Tasks which
+	 * don't report anything are counted as one step
+	 * @param count count of instructions
+	 */
+	void charge_steps(unsigned int count) {
+		steps += count;
+	}
 	///Raise exception
 	/** When exception is raised, tasks are explored from top to bottom to handle exception.
 	 * If task can handle exception, it will continue to run, otherwise exception is thrown to
@@ -178,6 +293,14 @@ public:
 	Value top_value() const;
 	///retrieve value from stack, index is counted from top
 	Value get_value(std::size_t idx) const;
+	///retrieve reference to value on stack, index is counted from top
+	/**
+	 * Allows to replace value in place without pushing and popping. The caller
+	 * must check stack size. Param pack is not collapsed
+	 */
+	Value &top_ref(std::size_t idx = 0) {return calcStack[calcStack.size()-idx-1];}
+	///count of values on stack
+	std::size_t stack_size() const {return calcStack.size();}
 	ValueList top_params() const;
 	///Defines param pack
 	/** Param pack can exist only on top of stack
@@ -193,10 +316,64 @@ public:
 	 */
 	void define_param_pack(std::size_t arguments);
 	void collapse_param_pack();
+	///Marks values on top of the stack as arguments of the next call
+	/**
+	 * Arguments stay on the stack as a window. If the called function doesn't accept
+	 * the window (see AbstractFunction::acceptsArgWindow), the param pack is created
+	 * before the function is called.
+	 *
+	 * @param count count of arguments
+	 */
+	void define_arg_window(std::size_t count) {
+		pendingArgs = count;
+	}
+	///Binds arguments defined by define_arg_window to a function, which is going to be called
+	/**
+	 * Arguments are kept as window if the function accepts it, otherwise param pack is created
+	 */
+	void bind_args(const AbstractFunction &fnobj);
+	///Retrieves arguments of current function - window or param pack
+	/**
+	 * @note the result must not be used after the stack is changed (the window is not owned)
+	 */
+	ValueList top_args() const;
+	///Removes arguments of current function - window or param pack
+	void del_args();
+	///Pops object of a method call, which is under the argument window (if defined)
+	Value pop_call_object();
 
 	bool set_var(const std::string_view &name, const Value &value);
 	bool set_var(const Value &name, const Value &value);
+	///Sets variable, hash of the name is already known (see Block::constHashes)
+	bool set_var(const Value &name, std::size_t hash, const Value &value);
 	bool get_var(const std::string_view &name, Value &value);
+	///Retrieves variable, name has precomputed hash
+	bool get_var(const Scope::Key &name, Value &value);
+	///Retrieves local variable
+	/**
+	 * Reads the slot of the scope at given depth. If the scope is not owned by the block,
+	 * or the slot is not assigned, the variable is searched by name (see get_var)
+	 * @param block block (owner of slots)
+	 * @param depth depth of the scope, 0 is current scope
+	 * @param slot index of slot
+	 * @param name name of variable
+	 * @param value variable receives value
+	 * @return true found, false not found
+	 */
+	bool get_local(const Value &block, std::size_t depth, std::size_t slot, const Scope::Key &name, Value &value);
+	///Sets local variable
+	/**
+	 * Stores value to the slot of the current scope. The variable is stored by name only when
+	 * the scope is owned by other block, or when the value is undefined (so it still hides
+	 * variables of outer scopes)
+	 * @param block block (owner of slots)
+	 * @param slot index of slot
+	 * @param name name of variable
+	 * @param hash hash of the name (see Block::localHashes)
+	 * @param value value
+	 * @return true success, false already assigned
+	 */
+	bool set_local(const Value &block, std::size_t slot, const Value &name, std::size_t hash, const Value &value);
 	///"scope_base" is defined as base object of current scope
 	Value get_scope_base() const;
 
@@ -295,6 +472,38 @@ public:
 	///Disables time stop
 	void clearTimeStop();
 
+	///Sets max count of steps, which can be executed
+	/**
+	 * When the count is exhausted, ExecutionLimitReached is thrown. The limit is deterministic,
+	 * it doesn't depend on speed of the machine. It must be reset, otherwise no further
+	 * execution is possible.
+	 *
+	 * @param count count of steps counted from now (see getStepCount)
+	 */
+	void setFuel(std::uint64_t count);
+	///Disables fuel limit
+	void clearFuel();
+
+	///Retrieves count of bytes allocated by JSON values created by the virtual machine
+	/**
+	 * Allocated memory is counted until it is released, even if the values live
+	 * longer than the virtual machine.
+	 *
+	 * @return count of bytes in use, returns 0 if memory accounting is not enabled
+	 */
+	std::size_t getMemoryUsage() const {
+		return memMeter?memMeter->getUsage():0;
+	}
+
+	///Retrieves count of executed steps
+	/**
+	 * Each executed instruction is counted as one step. Also each run of a native task
+	 * is counted as one step
+	 */
+	std::uint64_t getStepCount() const {
+		return steps;
+	}
+
 	///Sets max execution time
 	/**
 	 * When execution time is reached, it must be reset otherwise no futher execution is possible.
@@ -305,6 +514,29 @@ public:
 		setTimeStop(std::chrono::system_clock::now()+dur);
 	}
 
+	const Config& getConfig() const {
+		return cfg;
+	}
+
+	///Retrieves class epoch
+	/**
+	 * Class epoch is changed everytime, when resolution of a type class (Array, String, etc)
+	 * can change - when such variable is defined, or when scope which defines it is
+	 * left. It allows to cache results of lookups through type classes
+	 */
+	unsigned int getClassEpoch() const {
+		return classEpoch;
+	}
+
+	///Retrieves private copy of constants of a block
+	/**
+	 * @param owner block value, which owns the constants (it is used as a key)
+	 * @param consts constants of the block
+	 * @return copy of constants (see localizeValue), which is private for this virtual machine.
+	 * Interned names (see Atoms) are not copied, they are compared by identity
+	 */
+	std::shared_ptr<const std::vector<Value> > pin_consts(const Value &owner, const std::vector<Value> &consts);
+
 	const CalcStack& getCalcStack() const {
 		return calcStack;
 	}
@@ -335,21 +567,54 @@ protected:
 	TaskStack tmpTasks;	 //<temporary task - while task being processed
 	CalcStack calcStack;
 	ScopeStack scopeStack;
-	ScopeStack tmpScopes;	//preallocated scopes
+	ScopeStack tmpScopes;	//released scopes - their storage is reused by push_scope
 	Value globalScope;
 	std::exception_ptr exp = nullptr;
 	std::vector<CodeLocation> exp_location;
 	std::optional<std::chrono::system_clock::time_point> timeStop;
+	///count of executed steps
+	std::uint64_t steps = 0;
+	///step count when limits are checked next time
+	std::uint64_t nextCheck = 0;
+	///step count when fuel is exhausted
+	std::optional<std::uint64_t> fuelStop;
+	///step count when current run(budget) is suspended
+	std::uint64_t sliceStop = noLimit;
+
+	static constexpr std::uint64_t noLimit = ~std::uint64_t(0);
+
+	static constexpr std::size_t noArgWindow = ~std::size_t(0);
+	///count of arguments of the next call (define_arg_window)
+	std::size_t pendingArgs = noArgWindow;
+	///count of arguments of the current call, which are kept on the stack
+	std::size_t argWindow = noArgWindow;
+
+	///memory meter, if memory accounting is enabled
+	MemoryMeter::Ptr memMeter;
+	///arena of current exec(), if enabled
+	MemoryArena::Ptr arena;
 
 	enum class RunMode {
 		run_fast,
 		run_add_task,
-		run_fast_wtimer,
+		run_limited,
 		run_reset,
 		run_exception
 	};
 
 	RunMode run_mode = RunMode::run_reset;
+	unsigned int classEpoch = 0;
+
+	struct PinnedConsts {
+		///keeps owner alive, so the key is not reused
+		Value owner;
+		std::shared_ptr<const std::vector<Value> > consts;
+	};
+	using PinnedLRU = std::list<PinnedConsts>;
+	///pinned constants of blocks, most recently used first (see pin_consts)
+	PinnedLRU pinnedConsts;
+	///index of pinned constants by the owner
+	std::unordered_map<const json::IValue *, PinnedLRU::iterator> pinnedIndex;
 
 	AbstractTask *curTask;
 
@@ -363,13 +628,28 @@ protected:
 
 	bool comile_time = false;
 
+	bool run_step();
+	///packs count of values on top of the stack to a param pack (single value is not packed)
+	void pack_arguments(std::size_t count);
 	bool run_fast();
 	bool run_add_task();
-	bool run_fast_wtimer();
+	bool run_limited();
+	///checks limits, throws exception when a limit is reached
+	void check_limits();
+	///limits were changed, check them at next step
+	void update_limits();
+	bool has_limits() const {
+		return timeStop.has_value() || fuelStop.has_value() || sliceStop != noLimit;
+	}
 	bool run_reset();
 	bool run_exception();
 
 	void push_cb_task(std::unique_ptr<AbstractTask> &&);
+	void check_class_def(Scope &scope, const std::string_view &name);
+	///Pushes new scope to scope stack, reuses released scope if available
+	Scope &alloc_scope();
+	///Releases scopes above given count, storage of released scopes is kept for reuse
+	void release_scopes(std::size_t count);
 
 };
 
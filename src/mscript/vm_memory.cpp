@@ -0,0 +1,202 @@
+/*
+ * vm_memory.cpp
+ *
+ *  Created on: 18. 10. 2026
+ *      Author: ondra
+ */
+
+#include <cstddef>
+#include <mutex>
+#include <stdexcept>
+#include <imtjson/allocator.h>
+#include "exceptions.h"
+#include "vm_memory.h"
+
+namespace mscript {
+
+namespace {
+
+///Header of every allocated block, it is stored right before the returned pointer
+struct BlockHeader {
+	///MemoryMeter or MemoryArena (see size)
+	void *owner;
+	///size of block (including header) shifted left by 1, bit 0 is set when owner is arena
+	std::size_t size;
+	///pointer returned by the previous allocator (not used for arena)
+	void *base;
+};
+
+///Blocks of the accounting allocator are tagged by their address
+/**
+ * Returned pointer is always tagAddress modulo tagAlign. The previous allocator
+ * must return blocks aligned to tagAlign, so blocks allocated before the
+ * accounting allocator has been installed are recognized and passed to the previous
+ * allocator. The alignment is checked by install() and by every allocation
+ */
+constexpr std::uintptr_t tagAlign = 16;
+constexpr std::uintptr_t tagAddress = 8;
+static_assert(__STDCPP_DEFAULT_NEW_ALIGNMENT__ >= tagAlign, "Default allocator must align blocks to 16 bytes");
+
+bool isAligned(const void *ptr) {
+	return (reinterpret_cast<std::uintptr_t>(ptr) & (tagAlign - 1)) == 0;
+}
+
+void alignmentError() {
+	throw std::runtime_error("MemoryMeter: the previous JSON allocator doesn't align blocks to 16 bytes");
+}
+
+///Calculates offset of the returned pointer from the start of the block
+constexpr std::size_t tagOffset(std::uintptr_t base) {
+	return sizeof(BlockHeader) + ((tagAddress - base - sizeof(BlockHeader)) & (tagAlign - 1));
+}
+///Extra space needed for the header and the tag
+constexpr std::size_t tagReserve = sizeof(BlockHeader) + tagAlign;
+
+bool isTagged(const void *ptr) {
+	return (reinterpret_cast<std::uintptr_t>(ptr) & (tagAlign - 1)) == tagAddress;
+}
+
+const json::Allocator *prevAllocator = nullptr;
+thread_local MemoryMeter *curMeter = nullptr;
+thread_local MemoryArena *curArena = nullptr;
+
+}
+
+bool MemoryMeter::tryCharge(std::size_t sz) {
+	auto u = (used.fetch_add(sz, std::memory_order_relaxed) + sz) & byteMask;
+	if (limit && static_cast<std::size_t>(u) > limit) {
+		used.fetch_sub(sz, std::memory_order_relaxed);
+		return false;
+	}
+	return true;
+}
+
+void MemoryMeter::charge(std::size_t sz) {
+	if (!tryCharge(sz)) throw ExecutionLimitReached(LimitType::memory);
+}
+
+void *MemoryMeter::alloc(std::size_t sz) {
+	//arena chunks are aligned to tagAlign, so the arena uses multiples of tagAlign
+	std::size_t total = (sz + tagReserve + tagAlign - 1) & ~(tagAlign - 1);
+	MemoryMeter *m = curMeter;
+	MemoryArena *a = curArena;
+	if (a) {
+		//the arena charges whole chunks
+		char *p = reinterpret_cast<char *>(a->alloc(total));
+		if (p) {
+			BlockHeader *h = reinterpret_cast<BlockHeader *>(p + tagOffset(reinterpret_cast<std::uintptr_t>(p)))-1;
+			h->owner = a;
+			h->size = (total << 1) | 1;
+			h->base = p;
+			return h+1;
+		}
+	}
+	if (m) m->charge(total);
+	try {
+		char *p = reinterpret_cast<char *>(prevAllocator->alloc(total));
+		if (!isAligned(p)) {
+			prevAllocator->dealloc(p);
+			alignmentError();
+		}
+		BlockHeader *h = reinterpret_cast<BlockHeader *>(p + tagOffset(reinterpret_cast<std::uintptr_t>(p)))-1;
+		h->owner = m;
+		h->size = total << 1;
+		h->base = p;
+		return h+1;
+	} catch (...) {
+		if (m) m->release(total);
+		throw;
+	}
+}
+
+void MemoryMeter::dealloc(void *ptr) {
+	if (!ptr) return;
+	if (!isTagged(ptr)) {
+		//allocated before the accounting allocator has been installed
+		prevAllocator->dealloc(ptr);
+		return;
+	}
+	BlockHeader *h = reinterpret_cast<BlockHeader *>(ptr)-1;
+	if (h->size & 1) {
+		reinterpret_cast<MemoryArena *>(h->owner)->release(1);
+	} else {
+		std::int64_t sz = h->size >> 1;
+		MemoryMeter *m = reinterpret_cast<MemoryMeter *>(h->owner);
+		prevAllocator->dealloc(h->base);
+		if (m) m->release(sz);
+	}
+}
+
+void MemoryMeter::install() {
+	static const json::Allocator meterAllocator = {&MemoryMeter::alloc, &MemoryMeter::dealloc};
+	static std::once_flag once;
+	std::call_once(once, []{
+		const json::Allocator *prev = json::Allocator::getInstance();
+		//blocks of the previous allocator must not look like tagged blocks
+		void *probe = prev->alloc(1);
+		bool aligned = isAligned(probe);
+		prev->dealloc(probe);
+		if (!aligned) alignmentError();
+		prevAllocator = prev;
+		json::setJSONAllocator(&meterAllocator);
+	});
+}
+
+bool MemoryMeter::isInstalled() {
+	return prevAllocator != nullptr;
+}
+
+MemoryMeter::Ptr MemoryMeter::create(std::size_t limit) {
+	return Ptr(new MemoryMeter(limit));
+}
+
+MemoryMeter::Scope::Scope(MemoryMeter *m, MemoryArena *a):prevMeter(curMeter),prevArena(curArena) {
+	curMeter = m;
+	curArena = a;
+}
+
+MemoryMeter::Scope::~Scope() {
+	curMeter = prevMeter;
+	curArena = prevArena;
+}
+
+MemoryArena::Ptr MemoryArena::create(MemoryMeter *meter, std::size_t maxSize) {
+	return Ptr(new MemoryArena(meter, maxSize));
+}
+
+MemoryArena::MemoryArena(MemoryMeter *meter, std::size_t maxSize)
+	:meter(meter),maxSize(maxSize) {
+	//arena keeps the meter alive
+	if (meter) meter->used.fetch_add(MemoryMeter::keepAlive, std::memory_order_relaxed);
+}
+
+MemoryArena::~MemoryArena() {
+	for (char *c: chunks) ::operator delete(c);
+	//all chunks were charged to the meter
+	if (meter) meter->release(static_cast<std::int64_t>(chunkTotal) + MemoryMeter::keepAlive);
+}
+
+void *MemoryArena::alloc(std::size_t sz) {
+	if (sz > remain) {
+		//large blocks are not allocated from the arena
+		if (sz > chunkSize/4 || chunkTotal + chunkSize > maxSize) return nullptr;
+		if (meter && !meter->tryCharge(chunkSize)) return nullptr;
+		try {
+			chunks.reserve(chunks.size()+1);
+			ptr = reinterpret_cast<char *>(::operator new(chunkSize));
+		} catch (...) {
+			if (meter) meter->release(chunkSize);
+			throw;
+		}
+		chunks.push_back(ptr);
+		chunkTotal += chunkSize;
+		remain = chunkSize;
+	}
+	void *r = ptr;
+	ptr += sz;
+	remain -= sz;
+	live.fetch_add(1, std::memory_order_relaxed);
+	return r;
+}
+
+}
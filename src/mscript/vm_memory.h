@@ -0,0 +1,175 @@
+/*
+ * vm_memory.h
+ *
+ *  Created on: 18. 10. 2026
+ *      Author: ondra
+ */
+
+#ifndef SRC_MSCRIPT_VM_MEMORY_H_
+#define SRC_MSCRIPT_VM_MEMORY_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace mscript {
+
+class MemoryArena;
+
+///Measures memory allocated by JSON values created by a virtual machine
+/**
+ * Accounting is performed by an allocator installed to the imtjson library (see install()).
+ * Every allocation made while the meter is active on the current thread (see Scope)
+ * is charged to the meter. The memory is returned to the meter, when the allocated
+ * block is released - regardless on which thread it happens.
+ *
+ * The meter is destroyed when it is released by its owner and all memory charged
+ * to the meter has been released.
+ */
+class MemoryMeter {
+public:
+
+	///Installs accounting allocator to the imtjson library
+	/**
+	 * Can be called at any time, values created before are released by the previous
+	 * allocator (they are not charged to any meter). Function can be called multiple times.
+	 * It is called by the VirtualMachine, when its configuration requests accounting.
+	 *
+	 * @exception std::runtime_error the current allocator doesn't align blocks to 16 bytes,
+	 * the accounting allocator is not installed
+	 */
+	static void install();
+	///Returns true, when accounting allocator is installed
+	static bool isInstalled();
+
+	///Deleter used by owner of the meter
+	struct Release {
+		void operator()(MemoryMeter *m) const {m->release(keepAlive);}
+	};
+
+	using Ptr = std::unique_ptr<MemoryMeter, Release>;
+
+	///Create meter
+	/**
+	 * @param limit max allocated memory in bytes. When allocation exceeds the limit,
+	 * ExecutionLimitReached is thrown. Set 0 to unlimited
+	 * @return owning pointer
+	 */
+	static Ptr create(std::size_t limit);
+
+	///Retrieves count of bytes allocated and not yet released (chunks of arenas are counted whole)
+	std::size_t getUsage() const {
+		return static_cast<std::size_t>(used.load(std::memory_order_relaxed) & byteMask);
+	}
+
+	///Activates the meter and the arena on the current thread, previous state is restored in destructor
+	/**
+	 * Use Scope(nullptr) to create values which are not charged to any meter or arena (for
+	 * example caches)
+	 */
+	class Scope {
+	public:
+		Scope(MemoryMeter *m, MemoryArena *a = nullptr);
+		~Scope();
+		Scope(const Scope &) = delete;
+		Scope &operator=(const Scope &) = delete;
+	protected:
+		MemoryMeter *prevMeter;
+		MemoryArena *prevArena;
+	};
+
+protected:
+	MemoryMeter(std::size_t limit):limit(limit) {}
+
+	///one reference which keeps the meter alive (owner, arena)
+	/**
+	 * References are counted in the upper bits of the counter, so both the
+	 * allocated bytes and the references are updated by a single atomic operation
+	 */
+	static constexpr std::int64_t keepAlive = std::int64_t(1) << 48;
+	///mask of allocated bytes in the counter
+	static constexpr std::int64_t byteMask = keepAlive - 1;
+
+	///allocated bytes (lower bits) + references (see keepAlive)
+	std::atomic<std::int64_t> used = keepAlive;
+	std::size_t limit;
+
+	///releases bytes or references, destroys the meter, when nothing remains
+	void release(std::int64_t sz) {
+		if (used.fetch_sub(sz, std::memory_order_acq_rel) == sz) delete this;
+	}
+
+	///charges bytes, throws ExecutionLimitReached, when the limit is exceeded
+	void charge(std::size_t sz);
+	///charges bytes, returns false when the limit would be exceeded
+	bool tryCharge(std::size_t sz);
+
+	static void *alloc(std::size_t sz);
+	static void dealloc(void *ptr);
+
+	friend class MemoryArena;
+};
+
+///Arena for values created during single execution
+/**
+ * Blocks are allocated from large chunks and they are not released individually. All
+ * chunks are released at once, when the arena is released by its owner and all
+ * blocks allocated from the arena are released. So a value which escapes from the
+ * execution doesn't cause dangling pointer, it just keeps the arena alive.
+ *
+ * Whole chunks are charged to the meter, because their memory is not reused. When
+ * the next chunk doesn't fit to the limit of the meter, blocks are allocated by the
+ * standard allocator and charged individually.
+ *
+ * Requires MemoryMeter::install(). Arena is activated by MemoryMeter::Scope
+ */
+class MemoryArena {
+public:
+
+	///Deleter used by owner of the arena
+	struct Release {
+		void operator()(MemoryArena *a) const {a->release(1);}
+	};
+
+	using Ptr = std::unique_ptr<MemoryArena, Release>;
+
+	///Create arena
+	/**
+	 * @param meter meter, where allocations are charged (can be nullptr)
+	 * @param maxSize max size of the arena. When it is reached, next blocks are allocated
+	 * by the standard allocator
+	 * @return owning pointer
+	 */
+	static Ptr create(MemoryMeter *meter, std::size_t maxSize);
+
+	///Retrieves size of allocated chunks
+	std::size_t getSize() const {return chunkTotal;}
+
+protected:
+	MemoryArena(MemoryMeter *meter, std::size_t maxSize);
+	~MemoryArena();
+
+	static constexpr std::size_t chunkSize = 64*1024;
+
+	MemoryMeter *meter;
+	std::size_t maxSize;
+	std::size_t chunkTotal = 0;
+	std::vector<char *> chunks;
+	char *ptr = nullptr;
+	std::size_t remain = 0;
+	///count of allocated blocks + 1 for the owner
+	std::atomic<std::int64_t> live = 1;
+
+	///allocate block, returns nullptr if arena is full
+	void *alloc(std::size_t sz);
+	void release(std::int64_t cnt) {
+		if (live.fetch_sub(cnt, std::memory_order_acq_rel) == cnt) delete this;
+	}
+
+	friend class MemoryMeter;
+};
+
+}
+
+#endif /* SRC_MSCRIPT_VM_MEMORY_H_ */
@@ -0,0 +1,77 @@
+/*
+ * vm_pool.cpp
+ *
+ *  Created on: 18. 10. 2026
+ *      Author: ondra
+ */
+
+#include <algorithm>
+#include "block.h"
+#include "function.h"
+#include "vm_pool.h"
+
+namespace mscript {
+
+VMPool::VMPool(Value globalScope, unsigned int threads, const VirtualMachine::Config &cfg)
+	:globalScope(globalScope),cfg(cfg) {
+	this->cfg.pinConstants = true;
+	if (threads == 0) threads = std::max(std::thread::hardware_concurrency(), 1U);
+	workers.reserve(threads);
+	for (unsigned int i = 0; i < threads; i++) {
+		workers.push_back(std::thread([this]{worker();}));
+	}
+}
+
+VMPool::~VMPool() {
+	{
+		std::unique_lock _(mx);
+		stop = true;
+	}
+	cond.notify_all();
+	for (auto &t: workers) t.join();
+}
+
+std::future<Value> VMPool::submit(Job &&job) {
+	Item item{std::move(job), std::promise<Value>()};
+	auto f = item.promise.get_future();
+	{
+		std::unique_lock _(mx);
+		queue.push_back(std::move(item));
+	}
+	cond.notify_one();
+	return f;
+}
+
+std::future<Value> VMPool::submit(Value block, Value vars) {
+	return submit([block, vars](VirtualMachine &vm){
+		vm.push_scope(vars);
+		vm.push_task(std::make_unique<BlockExecution>(block));
+		Value r = vm.exec();
+		vm.pop_scope();
+		return r;
+	});
+}
+
+void VMPool::worker() {
+	VirtualMachine vm(cfg);
+	vm.setGlobalScope(localizeValue(globalScope));
+	std::unique_lock lk(mx);
+	for(;;) {
+		cond.wait(lk, [&]{return stop || !queue.empty();});
+		if (queue.empty()) break;
+		Item item = std::move(queue.front());
+		queue.pop_front();
+		lk.unlock();
+		try {
+			item.promise.set_value(item.job(vm));
+		} catch (...) {
+			item.promise.set_exception(std::current_exception());
+			//drop state of failed execution
+			vm.reset();
+			while (vm.run()) {}
+		}
+		lk.lock();
+	}
+}
+
+}
@@ -0,0 +1,85 @@
+/*
+ * vm_pool.h
+ *
+ *  Created on: 18. 10. 2026
+ *      Author: ondra
+ */
+
+#ifndef SRC_MSCRIPT_VM_POOL_H_
+#define SRC_MSCRIPT_VM_POOL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include "vm.h"
+
+namespace mscript {
+
+///Pool of threads, each thread has own virtual machine
+/**
+ * Compiled blocks are immutable, so they can be shared between threads. Each thread
+ * receives own copy of the global scope (see localizeValue), so lookups of runtime
+ * objects (Math, Array, String, ...) don't touch reference counters shared with other
+ * threads. Virtual machines of the pool also use private copies of constants of
+ * compiled blocks (see VirtualMachine::Config::pinConstants)
+ */
+class VMPool {
+public:
+
+	///Job executed on a virtual machine - returns result of the job
+	using Job = std::function<Value(VirtualMachine &)>;
+
+	///Construct the pool
+	/**
+	 * @param globalScope global scope - each thread receives own copy
+	 * @param threads count of threads. If zero is passed, count of hardware threads is used
+	 * @param cfg configuration of virtual machines (pinConstants is always enabled)
+	 */
+	VMPool(Value globalScope, unsigned int threads = 0, const VirtualMachine::Config &cfg = VirtualMachine::Config());
+	///Destroy the pool - finishes all pending jobs
+	~VMPool();
+
+	VMPool(const VMPool &) = delete;
+	VMPool &operator=(const VMPool &) = delete;
+
+	///Submit a job
+	/**
+	 * @param job function called in context of a thread with its virtual machine
+	 * @return future result of the job. Exceptions are passed through the future
+	 */
+	std::future<Value> submit(Job &&job);
+	///Submit compiled block
+	/**
+	 * @param block compiled block (see Compiler)
+	 * @param vars optional object with variables which are visible to the block
+	 * @return future result of the block
+	 */
+	std::future<Value> submit(Value block, Value vars = Value());
+
+	///Retrieves count of threads
+	unsigned int getThreadCount() const {return static_cast<unsigned int>(workers.size());}
+
+protected:
+
+	struct Item {
+		Job job;
+		std::promise<Value> promise;
+	};
+
+	Value globalScope;
+	VirtualMachine::Config cfg;
+	std::mutex mx;
+	std::condition_variable cond;
+	std::deque<Item> queue;
+	std::vector<std::thread> workers;
+	bool stop = false;
+
+	void worker();
+};
+
+}
+
+#endif /* SRC_MSCRIPT_VM_POOL_H_ */
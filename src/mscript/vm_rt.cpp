@@ -17,7 +17,6 @@
 #include "block.h"
 #include "function.h"
 #include "vm_rt.h"
-#include "generator.h"
 #include "mathex.h"
 #include <random>
 
@@ -105,55 +104,179 @@ protected:
 };
 
 
-class ArraySort: public AbstractTask, public Generator {
+///Sorts array using a script comparator
+/**
+ * Implemented as bottom-up merge sort. The task is a state machine, which
+ * suspends on every comparison and calls the comparator on the virtual machine.
+ * When the result arrives, the merge continues where it stopped
+ */
+class ArraySort: public AbstractTask {
 public:
-	ArraySort(Value arr, Value fn):arr(arr),fn(fn) {
-	}
-
-	~ArraySort() {
-	}
-
-	void generatingFunction() override {
-		result = arr.sort([&](Value a, Value b){
-			left = a;
-			right = b;
-			side = 0;
-			suspend_generator();
-			return res;
-		});
+	ArraySort(Value arr, Value fn):fn(fn) {
+		items.reserve(arr.size());
+		for (Value x: arr) items.push_back(x);
+		tmp.resize(items.size());
 	}
 
 	virtual bool init(VirtualMachine &vm) override {
-		resume_generator();
-		if (done) {
-			vm.push_value(result);
-			return false;
-		} else {
-			vm.call_function(fn, Value(), left,right);
-			return true;
-		}
+		start_merge();
+		return next(vm);
 	}
 	virtual bool run(VirtualMachine &vm) override {
 		Value cmpRes =vm.pop_value();
-		if (cmpRes.flags() & (json::numberInteger || json::numberUnsignedInteger)) {
+		int res;
+		if (cmpRes.flags() & (json::numberInteger | json::numberUnsignedInteger)) {
 			auto x = cmpRes.getIntLong();
 			res = x<0?-1:x>0?1:0;
 		} else {
 			double x = cmpRes.getNumber();
 			res = x==0?0:std::signbit(x)?-1:1;
 		}
-		return init(vm);
+		//take left item when equal - keeps sort stable
+		if (res > 0) tmp[k++] = std::move(items[j++]);
+		else tmp[k++] = std::move(items[i++]);
+		return next(vm);
 	}
 
 
 protected:
-	Value arr;
 	Value fn;
-	Value left;
-	Value right;
-	int res = 0;
-	Value result;
+	///items being sorted - contains runs of size width
+	std::vector<Value> items;
+	///output of the current pass
+	std::vector<Value> tmp;
+	///size of sorted runs
+	std::size_t width = 1;
+	///position of current merge (left run, right run, end)
+	std::size_t lo = 0, mid = 0, hi = 0;
+	///position in the left run, the right run and the output
+	std::size_t i = 0, j = 0, k = 0;
+
+	void start_merge() {
+		mid = std::min(lo+width, items.size());
+		hi = std::min(lo+2*width, items.size());
+		i = lo;
+		j = mid;
+		k = lo;
+	}
 
+	///Continues merging until comparison is needed
+	/**
+	 * @retval true comparator has been called, wait for result
+	 * @retval false done, result is on the stack
+	 */
+	bool next(VirtualMachine &vm) {
+		for(;;) {
+			if (i < mid && j < hi) {
+				vm.call_function(fn, Value(), items[i], items[j]);
+				return true;
+			}
+			while (i < mid) tmp[k++] = std::move(items[i++]);
+			while (j < hi) tmp[k++] = std::move(items[j++]);
+			lo = hi;
+			if (lo >= items.size()) {
+				std::swap(items, tmp);
+				width *= 2;
+				if (width >= items.size()) {
+					vm.push_value(Value(json::array, items.begin(), items.end(), [](const Value &x){return x;}));
+					return false;
+				}
+				lo = 0;
+			}
+			start_merge();
+		}
+	}
+};
+
+///Builtin ordering - native comparator
+/**
+ * The comparator can be called by a script as any other function, but when
+ * it is passed to Array.sort, the array is sorted entirely in C++
+ */
+class NativeOrder: public AbstractFunction {
+public:
+	enum Type {
+		///compare any values (numbers numerically, strings lexicographically)
+		generic,
+		///compare values as numbers
+		number,
+		///compare values as strings
+		string
+	};
+
+	NativeOrder(Type type, bool desc, Value key = Value()):type(type),desc(desc),key(key) {}
+
+	virtual void call(VirtualMachine &vm, const Value &, const Value &) const override {
+		auto params = vm.top_params();
+		int r = compare(params[0], params[1]);
+		vm.del_value();
+		vm.push_value(r);
+	}
+
+	///Compares two values
+	int compare(const Value &a, const Value &b) const {
+		int r;
+		if (key.defined()) r = compareValues(a[key.getString()], b[key.getString()]);
+		else r = compareValues(a,b);
+		return desc?-r:r;
+	}
+
+	///Sorts array (stable)
+	Value sort(const Value &arr) const {
+		std::vector<Value> items;
+		items.reserve(arr.size());
+		for (Value x: arr) items.push_back(x);
+		std::stable_sort(items.begin(), items.end(), [&](const Value &a, const Value &b){
+			return compare(a,b) < 0;
+		});
+		return Value(json::array, items.begin(), items.end(), [](const Value &x){return x;});
+	}
+
+	///Retrieves native order from a value
+	/**
+	 * @param v value
+	 * @return pointer to order, or nullptr, if the value is not native order
+	 */
+	static const NativeOrder *fromValue(const Value &v) {
+		if (!isFunction(v)) return nullptr;
+		return dynamic_cast<const NativeOrder *>(&getFunction(v));
+	}
+
+	///Creates function value
+	static Value define(Type type, bool desc, Value key = Value()) {
+		return packToValue(std::make_shared<NativeOrder>(type, desc, key), {"@FN","native"});
+	}
+
+	Type getType() const {return type;}
+	bool isDesc() const {return desc;}
+
+protected:
+	Type type;
+	bool desc;
+	Value key;
+
+	int compareValues(const Value &x, const Value &y) const {
+		switch (type) {
+			case number:
+				if ((x.flags() & (json::numberInteger | json::numberUnsignedInteger))
+						&& (y.flags() & (json::numberInteger | json::numberUnsignedInteger))) {
+					auto a = x.getIntLong();
+					auto b = y.getIntLong();
+					return a<b?-1:a>b?1:0;
+				} else {
+					double a = x.getNumber();
+					double b = y.getNumber();
+					return a<b?-1:a>b?1:0;
+				}
+			case string: {
+				int r = (x.type() == json::string?x.getString():x.toString().str())
+						.compare(y.type() == json::string?y.getString():y.toString().str());
+				return r<0?-1:r>0?1:0;
+			}
+			default:
+				return Value::compare(x,y);
+		}
+	}
 };
 
 template<typename Fn>
@@ -196,62 +319,62 @@ static Value rt = json::Object {
 		{"SQRT2",std::sqrt(2)},
 		{"INF",std::numeric_limits<double>::infinity()},
 		{"EPSILON",std::numeric_limits<double>::epsilon()},
-		{"abs",defineSimpleFn([](ValueList params){return std::abs(params[0].getNumber());})},
-		{"acos",defineSimpleFn([](ValueList params){return std::acos(params[0].getNumber());})},
-		{"acosh",defineSimpleFn([](ValueList params){return std::acosh(params[0].getNumber());})},
-		{"asin",defineSimpleFn([](ValueList params){return std::asin(params[0].getNumber());})},
-		{"asinh",defineSimpleFn([](ValueList params){return std::asinh(params[0].getNumber());})},
-		{"atan",defineSimpleFn([](ValueList params){return std::atan(params[0].getNumber());})},
-		{"atanh",defineSimpleFn([](ValueList params){return std::atanh(params[0].getNumber());})},
-		{"atan2",defineSimpleFn([](ValueList params){return std::atan2(params[0].getNumber(),params[1].getNumber());})},
-		{"cbrt",defineSimpleFn([](ValueList params){return std::cbrt(params[0].getNumber());})},
-		{"ceil",defineSimpleFn([](ValueList params){return std::ceil(params[0].getNumber());})},
-		{"cos",defineSimpleFn([](ValueList params){return std::cos(params[0].getNumber());})},
-		{"cosh",defineSimpleFn([](ValueList params){return std::cosh(params[0].getNumber());})},
-		{"exp",defineSimpleFn([](ValueList params){return std::exp(params[0].getNumber());})},
-		{"expm1",defineSimpleFn([](ValueList params){return std::expm1(params[0].getNumber());})},
-		{"floor",defineSimpleFn([](ValueList params){return std::floor(params[0].getNumber());})},
-		{"fround",defineSimpleFn([](ValueList params){return std::round(params[0].getNumber());})},
-		{"hypot",defineSimpleFn([](ValueList params){
+		{"abs",definePureFn([](ValueList params){return std::abs(params[0].getNumber());})},
+		{"acos",definePureFn([](ValueList params){return std::acos(params[0].getNumber());})},
+		{"acosh",definePureFn([](ValueList params){return std::acosh(params[0].getNumber());})},
+		{"asin",definePureFn([](ValueList params){return std::asin(params[0].getNumber());})},
+		{"asinh",definePureFn([](ValueList params){return std::asinh(params[0].getNumber());})},
+		{"atan",definePureFn([](ValueList params){return std::atan(params[0].getNumber());})},
+		{"atanh",definePureFn([](ValueList params){return std::atanh(params[0].getNumber());})},
+		{"atan2",definePureFn([](ValueList params){return std::atan2(params[0].getNumber(),params[1].getNumber());})},
+		{"cbrt",definePureFn([](ValueList params){return std::cbrt(params[0].getNumber());})},
+		{"ceil",definePureFn([](ValueList params){return std::ceil(params[0].getNumber());})},
+		{"cos",definePureFn([](ValueList params){return std::cos(params[0].getNumber());})},
+		{"cosh",definePureFn([](ValueList params){return std::cosh(params[0].getNumber());})},
+		{"exp",definePureFn([](ValueList params){return std::exp(params[0].getNumber());})},
+		{"expm1",definePureFn([](ValueList params){return std::expm1(params[0].getNumber());})},
+		{"floor",definePureFn([](ValueList params){return std::floor(params[0].getNumber());})},
+		{"fround",definePureFn([](ValueList params){return std::round(params[0].getNumber());})},
+		{"hypot",definePureFn([](ValueList params){
 			double v = 0;
 			for (Value a: params) {auto x = a.getNumber(); v+=x*x;}
 			return std::sqrt(v);
 		})},
-		{"log",defineSimpleFn([](ValueList params){return std::log(params[0].getNumber());})},
-		{"log1p",defineSimpleFn([](ValueList params){return std::log1p(params[0].getNumber());})},
-		{"log10",defineSimpleFn([](ValueList params){return std::log10(params[0].getNumber());})},
-		{"log2",defineSimpleFn([](ValueList params){return std::log2(params[0].getNumber());})},
-		{"max",defineSimpleFn([](ValueList params){
+		{"log",definePureFn([](ValueList params){return std::log(params[0].getNumber());})},
+		{"log1p",definePureFn([](ValueList params){return std::log1p(params[0].getNumber());})},
+		{"log10",definePureFn([](ValueList params){return std::log10(params[0].getNumber());})},
+		{"log2",definePureFn([](ValueList params){return std::log2(params[0].getNumber());})},
+		{"max",definePureFn([](ValueList params){
 			double v = params[0].getNumber();
 			for (Value a: params) {auto x = a.getNumber(); v = x>v?x:v;}
 			return v;})},
-		{"min",defineSimpleFn([](ValueList params){
+		{"min",definePureFn([](ValueList params){
 			double v = params[0].getNumber();
 			for (Value a: params) {auto x = a.getNumber(); v = x<v?x:v;}
 			return v;})},
-		{"pow",defineSimpleFn([](ValueList params){return std::pow(params[0].getNumber(),params[1].getNumber());})},
+		{"pow",definePureFn([](ValueList params){return std::pow(params[0].getNumber(),params[1].getNumber());})},
 		{"random",defineAsyncFunction([](VirtualMachine &vm, ValueList params){
 			if (vm.isComileTime()) vm.raise(std::make_exception_ptr(std::runtime_error("compile time")));
 			std::random_device rnd;
 			std::uniform_real_distribution<double> urd(0,1);
 			vm.push_value(urd(rnd));})},
-		{"round",defineSimpleFn([](ValueList params){return std::round(params[0].getNumber());})},
-		{"sign",defineSimpleFn([](ValueList params){
+		{"round",definePureFn([](ValueList params){return std::round(params[0].getNumber());})},
+		{"sign",definePureFn([](ValueList params){
 			double n = params[0].getNumber();
 			return n>0?1:n<0?-1:0;})},
-		{"sin",defineSimpleFn([](ValueList params){return std::sin(params[0].getNumber());})},
-		{"sinh",defineSimpleFn([](ValueList params){return std::sinh(params[0].getNumber());})},
-		{"sqrt",defineSimpleFn([](ValueList params){return std::sqrt(params[0].getNumber());})},
-		{"tan",defineSimpleFn([](ValueList params){return std::tan(params[0].getNumber());})},
-		{"trunc",defineSimpleFn([](ValueList params){return std::trunc(params[0].getNumber());})},
-		{"isfinite",defineSimpleFn([](ValueList params){return std::isfinite(params[0].getNumber());})},
-		{"isNaN",defineSimpleFn([](ValueList params){return std::isnan(params[0].getNumber());})},
-		{"erf",defineSimpleFn([](ValueList params){return std::erf(params[0].getNumber());})},
-		{"erfc",defineSimpleFn([](ValueList params){return std::erfc(params[0].getNumber());})},
-		{"tgamma",defineSimpleFn([](ValueList params){return std::tgamma(params[0].getNumber());})},
-		{"lgamma",defineSimpleFn([](ValueList params){return std::lgamma(params[0].getNumber());})},
-		{"expint",defineSimpleFn([](ValueList params){return std::expint(params[0].getNumber());})},
-		{"beta",defineSimpleFn([](ValueList params){return std::beta(params[0].getNumber(),params[1].getNumber());})},
+		{"sin",definePureFn([](ValueList params){return std::sin(params[0].getNumber());})},
+		{"sinh",definePureFn([](ValueList params){return std::sinh(params[0].getNumber());})},
+		{"sqrt",definePureFn([](ValueList params){return std::sqrt(params[0].getNumber());})},
+		{"tan",definePureFn([](ValueList params){return std::tan(params[0].getNumber());})},
+		{"trunc",definePureFn([](ValueList params){return std::trunc(params[0].getNumber());})},
+		{"isfinite",definePureFn([](ValueList params){return std::isfinite(params[0].getNumber());})},
+		{"isNaN",definePureFn([](ValueList params){return std::isnan(params[0].getNumber());})},
+		{"erf",definePureFn([](ValueList params){return std::erf(params[0].getNumber());})},
+		{"erfc",definePureFn([](ValueList params){return std::erfc(params[0].getNumber());})},
+		{"tgamma",definePureFn([](ValueList params){return std::tgamma(params[0].getNumber());})},
+		{"lgamma",definePureFn([](ValueList params){return std::lgamma(params[0].getNumber());})},
+		{"expint",definePureFn([](ValueList params){return std::expint(params[0].getNumber());})},
+		{"beta",definePureFn([](ValueList params){return std::beta(params[0].getNumber(),params[1].getNumber());})},
 /*		{"gcd",defineSimpleFn([](ValueList params){return std::gcd(params[0].getInt(),params[1].getInt());})},
 		{"lcm",defineSimpleFn([](ValueList params){return std::lcm(params[0].getInt(),params[1].getInt());})},*/
 		{"integral",defineAsyncFunction(mathIntegral)},
@@ -277,6 +400,8 @@ static Value rt = json::Object {
 		{"findIndex", defineAsyncMethod([](VirtualMachine &vm, Value obj, ValueList params){vm.push_task(std::make_unique<ArrayFindTask<true> >(obj,params[0]));})},
 		{"sort", defineAsyncMethod([](VirtualMachine &vm, Value obj, ValueList params){
 			if (obj.size()<2) vm.push_value(obj);
+			else if (!params[0].defined()) vm.push_value(NativeOrder(NativeOrder::generic, false).sort(obj));
+			else if (auto ord = NativeOrder::fromValue(params[0])) vm.push_value(ord->sort(obj));
 			else vm.push_task(std::make_unique<ArraySort>(obj,params[0]));})},
 		{"copy", defineAsyncMethod([](VirtualMachine &vm, Value obj, ValueList ){
 			if (obj.empty()) vm.push_value(obj);
@@ -341,6 +466,22 @@ static Value rt = json::Object {
 		})},
 
 	}},
+	{"Order",json::Object{
+		{"asc",NativeOrder::define(NativeOrder::generic, false)},
+		{"desc",NativeOrder::define(NativeOrder::generic, true)},
+		{"numAsc",NativeOrder::define(NativeOrder::number, false)},
+		{"numDesc",NativeOrder::define(NativeOrder::number, true)},
+		{"strAsc",NativeOrder::define(NativeOrder::string, false)},
+		{"strDesc",NativeOrder::define(NativeOrder::string, true)},
+		{"by",defineSimpleFn([](ValueList params){
+			Value key = params[0];
+			if (key.type() != json::string) throw std::runtime_error("Order.by - the first argument must be a string");
+			if (!params[1].defined()) return NativeOrder::define(NativeOrder::generic, false, key);
+			auto ord = NativeOrder::fromValue(params[1]);
+			if (!ord) throw std::runtime_error("Order.by - the second argument must be an order (Order.asc, Order.desc, etc)");
+			return NativeOrder::define(ord->getType(), ord->isDesc(), key);
+		})},
+	}},
 	{"__operator",json::Object{
 		{"in", defineSimpleFn([](ValueList lst){
 			auto str = lst[0].getString();
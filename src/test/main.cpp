@@ -6,6 +6,8 @@
  */
 
 #include <string_view>
+#include <chrono>
+#include <cstdlib>
 #include <fstream>
 #include <mscript/vm.h>
 #include <mscript/function.h>
@@ -14,6 +16,10 @@
 #include <mscript/parser.h>
 #include <mscript/disasm.h>
 #include <mscript/vm_rt.h>
+#include <mscript/vm_pool.h>
+#include <mscript/bytecode.h>
+#include <mscript/vm_memory.h>
+#include <mscript/script_cache.h>
 
 #include <shared/cmdline.h>
 
@@ -22,7 +28,13 @@ enum class Action {
 	showcode,
 	run,
 	debug,
-	console
+	console,
+	bench,
+	pbench,
+	fibbench,
+	compile,
+	memtest,
+	cachetest
 };
 
 json::NamedEnum<Action> strAction({
@@ -30,7 +42,13 @@ json::NamedEnum<Action> strAction({
 	{Action::showcode,"showcode"},
 	{Action::run,"run"},
 	{Action::debug,"debug"},
-	{Action::console,"console"}
+	{Action::console,"console"},
+	{Action::bench,"bench"},
+	{Action::pbench,"pbench"},
+	{Action::fibbench,"fibbench"},
+	{Action::compile,"compile"},
+	{Action::memtest,"memtest"},
+	{Action::cachetest,"cachetest"}
 });
 
 using mscript::getVirtualMachineRuntime;
@@ -50,6 +68,14 @@ static int openFile(CmdArgIter &iter, std::ifstream &fin) {
 	return 0;
 }
 
+///Compiles script, or loads already compiled script (see compile)
+static mscript::Value loadScript(std::ifstream &fin, mscript::Value global) {
+	std::string data((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+	if (mscript::isSerializedBlock(data)) return mscript::loadBlock(data);
+	mscript::Compiler cmp(global);
+	return cmp.compileString({"input",1}, data);
+}
+
 static int testParse(CmdArgIter &iter) {
 	std::ifstream fin;
 	int e = openFile(iter, fin);
@@ -155,12 +181,14 @@ static int run(CmdArgIter &iter, bool debug) {
 
 	Value global = getVirtualMachineRuntime();
 
-	Compiler cmp(global);
-	Value block = cmp.compileText({"input",1}, [&](){return fin.get();});
+	Value block = loadScript(fin, global);
 
 	setConsoleFunctions(global);
 
-	VirtualMachine vm;
+	VirtualMachine::Config cfg;
+	//debugger steps single instruction
+	if (debug) cfg.batchSize = 1;
+	VirtualMachine vm(cfg);
 	vm.setGlobalScope(global);
 	Value v;
 	if (debug) {
@@ -192,21 +220,18 @@ static int run(CmdArgIter &iter, bool debug) {
 						Value v = x.getBase();
 						for (Value vr : v) {
 							auto key = vr.getKey();
-							if (x.find(key) == x.end()) {
+							if (!x.isOwn(mscript::Scope::Key(key))) {
 								std::cout << vr.getKey() << "=";
 								printValue(vr);
 								std::cout << " ";
 							}
 						}
-						for (const auto &vr: x) {
-							if (vr.has_value()) {
-								const auto &var = *vr;
-								if (v[var.name.getString()].defined()) std::cout << "*";
-								std::cout << var.name.getString() << "=";
-								printValue(var.value);
-								std::cout << " ";
-							}
-						}
+						x.forEach([&](const Value &name, const Value &value) {
+							if (v[name.getString()].defined()) std::cout << "*";
+							std::cout << name.getString() << "=";
+							printValue(value);
+							std::cout << " ";
+						});
 						std::cout << std::endl;
 					}
 					i++;
@@ -262,6 +287,295 @@ static int run(CmdArgIter &iter, bool debug) {
 }
 
 
+static void setBenchConsoleFunctions(mscript::Value &global) {
+	using namespace mscript;
+	//benchmark measures the interpreter, not the console
+	global.setItems({
+		{"print",defineSimpleFn([](const ValueList &)->Value{return nullptr;})},
+		{"printnl",defineSimpleFn([](const ValueList &)->Value{return nullptr;})}
+	});
+}
+
+///Runs script multiple times and measures time of each dispatch backend
+static int bench(CmdArgIter &iter) {
+
+	using namespace mscript;
+
+	std::ifstream fin;
+	int e = openFile(iter, fin);
+	if (e) return e;
+	int count = 10;
+	auto cntstr = iter.getNext();
+	if (cntstr) count = std::max(std::atoi(cntstr),1);
+
+	Value global = getVirtualMachineRuntime();
+
+	Value block = loadScript(fin, global);
+
+	setBenchConsoleFunctions(global);
+
+	auto measure = [&](bool threaded) {
+		VirtualMachine::Config cfg;
+		cfg.threadedDispatch = threaded;
+		VirtualMachine vm(cfg);
+		vm.setGlobalScope(global);
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < count; i++) {
+			vm.exec(std::make_unique<BlockExecution>(block));
+		}
+		auto end = std::chrono::steady_clock::now();
+		return std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+	};
+
+	auto tswitch = measure(false);
+	std::cout << "switch:\t\t" << tswitch << " us" << std::endl;
+#ifdef MSCRIPT_THREADED_DISPATCH
+	auto tthreaded = measure(true);
+	std::cout << "threaded:\t" << tthreaded << " us" << std::endl;
+	if (tthreaded) std::cout << "speedup:\t" << static_cast<double>(tswitch)/tthreaded << std::endl;
+#else
+	std::cout << "threaded:\t(not available)" << std::endl;
+#endif
+	return 0;
+}
+
+///Runs script multiple times on VMPool, measures scaling from 1 to N threads
+static int pbench(CmdArgIter &iter) {
+
+	using namespace mscript;
+
+	std::ifstream fin;
+	int e = openFile(iter, fin);
+	if (e) return e;
+	int count = 100;
+	auto cntstr = iter.getNext();
+	if (cntstr) count = std::max(std::atoi(cntstr),1);
+	unsigned int maxThreads = std::max(std::thread::hardware_concurrency(), 1U);
+
+	Value global = getVirtualMachineRuntime();
+
+	Value block = loadScript(fin, global);
+
+	setBenchConsoleFunctions(global);
+
+	double base = 0;
+	for (unsigned int threads = 1; threads <= maxThreads; threads = threads < maxThreads?std::min(threads*2, maxThreads):threads+1) {
+		VMPool pool(global, threads);
+		std::vector<std::future<Value> > results;
+		results.reserve(count);
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < count; i++) {
+			results.push_back(pool.submit(block));
+		}
+		for (auto &f: results) f.get();
+		auto end = std::chrono::steady_clock::now();
+		auto us = std::max<long long>(std::chrono::duration_cast<std::chrono::microseconds>(end - start).count(),1);
+		double rate = count * 1000000.0 / us;
+		if (threads == 1) base = rate;
+		std::cout << "threads: " << threads << "\t" << us << " us\t" << rate << " runs/s\tspeedup: " << rate/base << std::endl;
+	}
+	return 0;
+}
+
+///Measures recursive calls (fibonacci), reports allocations of tasks per call
+static int fibbench(CmdArgIter &iter) {
+
+	using namespace mscript;
+
+	int n = 25;
+	auto nstr = iter.getNext();
+	if (nstr) n = std::max(std::atoi(nstr),1);
+
+	Value global = getVirtualMachineRuntime();
+	Compiler cmp(global);
+	Value block = cmp.compileString({"fibbench",1},
+			"fib=n=>{n<2?n:fib(n-1)+fib(n-2)}\n"
+			"fib("+std::to_string(n)+")");
+
+	//count of calls of fib(n) is 2*fib(n+1)-1
+	std::uint64_t a = 0, b = 1;
+	for (int i = 0; i <= n; i++) {
+		std::uint64_t c = a + b;
+		a = b;
+		b = c;
+	}
+	std::uint64_t calls = 2*a-1;
+
+	VirtualMachine vm;
+	vm.setGlobalScope(global);
+	auto stats1 = TaskPool::getStats();
+	auto start = std::chrono::steady_clock::now();
+	Value res = vm.exec(std::make_unique<BlockExecution>(block));
+	auto end = std::chrono::steady_clock::now();
+	auto stats2 = TaskPool::getStats();
+	auto tm = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+	auto allocs = stats2.allocations - stats1.allocations;
+	auto reuses = stats2.reuses - stats1.reuses;
+
+	std::cout << "fib(" << n << "):\t" << res.toString() << std::endl;
+	std::cout << "calls:\t\t" << calls << std::endl;
+	std::cout << "time:\t\t" << tm << " us" << std::endl;
+	std::cout << "task allocations:\t" << allocs << " (" << static_cast<double>(allocs)/calls << " per call)" << std::endl;
+	std::cout << "pooled tasks:\t\t" << reuses << " (" << static_cast<double>(reuses)/calls << " per call)" << std::endl;
+	return 0;
+}
+
+///Compiles script and stores compiled block to a file, which can be passed to other actions
+static int compile(CmdArgIter &iter) {
+
+	using namespace mscript;
+
+	std::ifstream fin;
+	int e = openFile(iter, fin);
+	if (e) return e;
+	auto outname = iter.getNext();
+	if (!outname) {
+		std::cerr << "Need argument <output file>" << std::endl;
+		return 3;
+	}
+
+	Value global = getVirtualMachineRuntime();
+
+	Compiler cmp(global);
+	Value block = cmp.compileText({"input",1}, [&](){return fin.get();});
+	std::string data = saveBlock(block);
+
+	std::ofstream fout(outname, std::ios::out|std::ios::binary|std::ios::trunc);
+	if (!fout) {
+		std::cerr << "Can't create file: " << outname << std::endl;
+		return 4;
+	}
+	fout.write(data.data(), data.size());
+
+	const auto &st = cmp.getCompileTimeStats();
+	std::cerr << "Compile time evaluation: " << st.folded << "/" << st.evaluated << " statements folded, "
+			<< st.exhausted << " exhausted budget, " << st.instructions << " instructions, "
+			<< std::chrono::duration_cast<std::chrono::microseconds>(st.duration).count() << " us" << std::endl;
+	if (!st.foldedLines.empty()) {
+		std::cerr << "Folded lines:";
+		for (auto l: st.foldedLines) std::cerr << " " << l+1;
+		std::cerr << std::endl;
+	}
+	return 0;
+}
+
+///Installs memory accounting and verifies, that the memory limit is enforced
+static int memtest(CmdArgIter &iter) {
+
+	using namespace mscript;
+
+	std::size_t limit = 1024*1024;
+	auto lstr = iter.getNext();
+	if (lstr) limit = std::max(std::atol(lstr), 1L);
+
+	//values created before (statics of the runtime) are released by the previous allocator
+	MemoryMeter::install();
+
+	Value global = getVirtualMachineRuntime();
+	//compile time evaluation would build the string during compilation
+	Compiler cmp(global, 0);
+	Value block = cmp.compileString({"memtest",1},
+			"s=\"x\"\n"
+			"for (I:1..24) {s=s+s}\n"
+			"s");
+
+	VirtualMachine::Config cfg;
+	cfg.maxMemory = limit;
+	VirtualMachine vm(cfg);
+	vm.setGlobalScope(global);
+	try {
+		Value r = vm.exec(std::make_unique<BlockExecution>(block));
+		std::cout << "memory limit not reached: " << r.getString().size() << " bytes" << std::endl;
+		return 1;
+	} catch (const ExecutionLimitReached &e) {
+		std::cout << "memory limit reached: " << static_cast<const std::exception &>(e).what() << std::endl;
+	}
+
+	//result of exec() must not reference values allocated from the arena
+	Value ablock = cmp.compileString({"memtest",1},
+			"n=4\n"
+			"fn=object (x)=>{x*n} {n=n*2}\n"
+			"[fn, [1,2]+[n], 0..n, \"a\"+n]");
+	VirtualMachine::Config acfg;
+	acfg.memoryAccounting = true;
+	acfg.execArena = true;
+	VirtualMachine avm(acfg);
+	avm.setGlobalScope(global);
+	Value r = avm.exec(std::make_unique<BlockExecution>(ablock));
+	auto held = avm.getMemoryUsage();
+	std::cout << "arena result: " << r.toString() << std::endl;
+	r = Value();
+	auto released = avm.getMemoryUsage();
+	if (held != released) {
+		std::cout << "result of exec() keeps the arena: " << (held - released) << " bytes" << std::endl;
+		return 1;
+	}
+	std::cout << "result of exec() is independent on the arena" << std::endl;
+	return 0;
+}
+
+static void printCacheStats(const char *step, const mscript::ScriptCache &cache) {
+	auto st = cache.getStats();
+	std::cout << step << ": hits=" << st.hits << " misses=" << st.misses
+			<< " diskHits=" << st.diskHits << " entries=" << st.entries << std::endl;
+}
+
+///Compiles script through the ScriptCache, forces eviction and reloads the script from the directory
+static int cachetest(CmdArgIter &iter) {
+
+	using namespace mscript;
+
+	std::ifstream fin;
+	int e = openFile(iter, fin);
+	if (e) return e;
+	auto dir = iter.getNext();
+	if (!dir) {
+		std::cerr << "Need argument <directory>" << std::endl;
+		return 3;
+	}
+	std::string source((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+	Value global = getVirtualMachineRuntime();
+	auto exec = [&](Value block) {
+		VirtualMachine vm;
+		vm.setGlobalScope(global);
+		return vm.exec(std::make_unique<BlockExecution>(block));
+	};
+
+	//the memory limit is set to hold just one compiled script
+	std::size_t size;
+	{
+		ScriptCache probe;
+		probe.compile(global, {"input",1}, source);
+		size = probe.getStats().memoryUsage;
+	}
+	ScriptCache cache(size + size/2, dir);
+
+	Value block = cache.compile(global, {"input",1}, source);
+	Value again = cache.compile(global, {"input",1}, source);
+	printCacheStats("compiled twice", cache);
+	if (block != again) {
+		std::cout << "second compilation didn't return the cached block" << std::endl;
+		return 1;
+	}
+	//same source at different location is different script, it evicts the first one
+	cache.compile(global, {"input",2}, source);
+	printCacheStats("evicted", cache);
+	Value loaded = cache.compile(global, {"input",1}, source);
+	printCacheStats("reloaded", cache);
+	if (cache.getStats().diskHits != 1) {
+		std::cout << "script was not loaded from the directory" << std::endl;
+		return 1;
+	}
+	Value expected = exec(block);
+	Value result = exec(loaded);
+	if (expected != result) {
+		std::cout << "reloaded script returned different result: " << result.toString() << std::endl;
+		return 1;
+	}
+	std::cout << "reloaded script returned: " << result.toString() << std::endl;
+	return 0;
+}
+
 static int console() {
 	using namespace mscript;
 	Value global = getVirtualMachineRuntime();
@@ -361,6 +675,12 @@ int main(int argc, char **argv) {
 			case Action::run: return run(argiter, false);
 			case Action::debug: return run(argiter, true);
 			case Action::console: return console();
+			case Action::bench: return bench(argiter);
+			case Action::pbench: return pbench(argiter);
+			case Action::fibbench: return fibbench(argiter);
+			case Action::compile: return compile(argiter);
+			case Action::memtest: return memtest(argiter);
+			case Action::cachetest: return cachetest(argiter);
 		}
 
 	} catch(const std::exception &e) {